@@ -3,22 +3,32 @@
 
 #include <algorithm>
 #include <any>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cfloat>
+#include <cmath>
 #if __has_include(<charconv>)
 #include <charconv>
 #endif
+#include <cstdint>
 #include <cstring>
+#include <fstream>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <set>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -27,6 +37,16 @@
 #error "Requires complete C++17 support"
 #endif
 
+// 在 x86 上使用 GCC/Clang 的 target 属性按函数启用 SSE2/AVX2/AVX-512，
+// 运行时通过 cpuid 选择实现，因此无需以 -mavx2 等选项编译整个程序。
+// 定义 PEG_NO_SIMD 可以强制只使用标量实现。
+#if !defined(PEG_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PEG_USE_X86_SIMD
+#define PEG_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
+
 namespace peg {
 
 /*-----------------------------------------------------------------------------
@@ -64,6 +84,39 @@ struct scope_exit {
   bool execute_on_destruction;
 };
 
+/*-----------------------------------------------------------------------------
+ *  SIMD dispatch
+ *---------------------------------------------------------------------------*/
+
+namespace detail {
+
+enum class SimdLevel { Scalar, SSE2, SSSE3, AVX2, AVX512 };
+
+// 检测当前 CPU 可用的最高 SIMD 指令集。结果只在第一次调用时计算。
+inline SimdLevel simd_level() {
+  static const SimdLevel level = [] {
+#ifdef PEG_USE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+      return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+      return SimdLevel::SSSE3;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+      return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::Scalar;
+  }();
+  return level;
+}
+
+}  // namespace detail
+
 /*-----------------------------------------------------------------------------
  *  UTF8 functions
  *---------------------------------------------------------------------------*/
@@ -83,7 +136,7 @@ struct scope_exit {
 //        第一个字节以 11110 开头，随后三个字节都以 10 开头。
 
 // 计算给定 UTF-8 编码字符串中第一个码点的字节长度。
-inline size_t codepoint_length(const char* s8, size_t l) {
+constexpr size_t codepoint_length(const char* s8, size_t l) {
   if (l) {
     auto b = static_cast<uint8_t>(s8[0]);
     // 首先检查长度是否为0，如果是，则返回0。
@@ -102,22 +155,111 @@ inline size_t codepoint_length(const char* s8, size_t l) {
   return 0;
 }
 
-// 计算 UTF-8 编码字符串中的码点数量。
-inline size_t codepoint_count(const char* s8, size_t l) {
+namespace detail {
+
+// 统计非 continuation 字节（不是 10xxxxxx 的字节）的数量。
+// 对合法的 UTF-8 而言这正是码点数量；对非法输入也总能终止。
+inline size_t count_lead_bytes_scalar(const char* s8, size_t l) {
   size_t count = 0;
-  // 遍历字符串，使用 codepoint_length 来跳过每个完整的码点。
-  for (size_t i = 0; i < l; i += codepoint_length(s8 + i, l - i)) {
-    count++;
+  size_t i = 0;
+  // SWAR：一次处理 8 个字节。continuation 字节的 bit7 为 1、bit6 为 0。
+  for (; i + 8 <= l; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, s8 + i, 8);
+    auto cont = (w & ~(w << 1) & 0x8080808080808080ULL) >> 7;
+    count += 8 - static_cast<size_t>((cont * 0x0101010101010101ULL) >> 56);
+  }
+  for (; i < l; i++) {
+    if ((static_cast<uint8_t>(s8[i]) & 0xC0) != 0x80) {
+      count++;
+    }
   }
-  // 计数并返回码点总数。
   return count;
 }
 
+#ifdef PEG_USE_X86_SIMD
+// 有符号比较下，只有 continuation 字节（0x80-0xBF，即 -128..-65）不大于
+// 0xBF。比较结果（-1）被逐字节累加，每 255 轮用 sad 归约一次以免溢出。
+PEG_TARGET("sse2")
+inline size_t count_lead_bytes_sse2(const char* s8, size_t l) {
+  const auto threshold = _mm_set1_epi8(static_cast<char>(0xBF));
+  size_t count = 0;
+  size_t i = 0;
+  while (i + 16 <= l) {
+    auto acc = _mm_setzero_si128();
+    for (size_t n = 0; n < 255 && i + 16 <= l; n++, i += 16) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s8 + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, threshold));
+    }
+    auto sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sum)) +
+             static_cast<size_t>(_mm_extract_epi16(sum, 4));
+  }
+  return count + count_lead_bytes_scalar(s8 + i, l - i);
+}
+
+PEG_TARGET("avx2")
+inline size_t count_lead_bytes_avx2(const char* s8, size_t l) {
+  const auto threshold = _mm256_set1_epi8(static_cast<char>(0xBF));
+  size_t count = 0;
+  size_t i = 0;
+  while (i + 32 <= l) {
+    auto acc = _mm256_setzero_si256();
+    for (size_t n = 0; n < 255 && i + 32 <= l; n++, i += 32) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s8 + i));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, threshold));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes),
+                       _mm256_sad_epu8(acc, _mm256_setzero_si256()));
+    count += static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+  }
+  return count + count_lead_bytes_scalar(s8 + i, l - i);
+}
+
+PEG_TARGET("avx512bw,popcnt")
+inline size_t count_lead_bytes_avx512(const char* s8, size_t l) {
+  const auto threshold = _mm512_set1_epi8(static_cast<char>(0xBF));
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 64 <= l; i += 64) {
+    auto v = _mm512_loadu_si512(s8 + i);
+    count += static_cast<size_t>(
+        __builtin_popcountll(_mm512_cmpgt_epi8_mask(v, threshold)));
+  }
+  return count + count_lead_bytes_scalar(s8 + i, l - i);
+}
+#endif
+
+}  // namespace detail
+
+// 计算 UTF-8 编码字符串中的码点数量。
+// 只统计非 continuation 字节，因此遇到非法的首字节也不会停滞。
+inline size_t codepoint_count(const char* s8, size_t l) {
+  using Kernel = size_t (*)(const char*, size_t);
+  static const Kernel kernel = []() -> Kernel {
+    switch (detail::simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+      case detail::SimdLevel::AVX512: return detail::count_lead_bytes_avx512;
+      case detail::SimdLevel::AVX2: return detail::count_lead_bytes_avx2;
+      case detail::SimdLevel::SSSE3:
+      case detail::SimdLevel::SSE2: return detail::count_lead_bytes_sse2;
+#endif
+      default: return detail::count_lead_bytes_scalar;
+    }
+  }();
+  // 短字符串不值得一次间接调用。
+  if (l < 16) {
+    return detail::count_lead_bytes_scalar(s8, l);
+  }
+  return kernel(s8, l);
+}
+
 // 将单个 Unicode 码点（char32_t）编码为 UTF-8 字符串。
 // 如果码点小于 0x0080（128），它是一个单字节的 ASCII 字符。
 // 如果码点在 0x0800 和 0xD800 之间，它将被编码为三个字节，
 // 第一个字节以 0xE0（1110 0000）开头，后两个字节以 0x80（1000 0000）开头。
-inline size_t encode_codepoint(char32_t cp, char* buff) {
+constexpr size_t encode_codepoint(char32_t cp, char* buff) {
   // 根据码点的大小将其编码为1到4个字节。
   // 排除了非法的 Unicode 范围（例如0xD800到0xDFFF）。
   if (cp < 0x0080) {
@@ -151,6 +293,22 @@ inline size_t encode_codepoint(char32_t cp, char* buff) {
   return 0;
 }
 
+// encode_codepoint 的定长缓冲区版本，可在常量表达式中使用。
+struct CodepointBuffer {
+  char data[4] = {};
+  size_t size = 0;
+
+  constexpr std::string_view view() const {
+    return std::string_view(data, size);
+  }
+};
+
+constexpr CodepointBuffer encode_codepoint_buffer(char32_t cp) {
+  CodepointBuffer buf;
+  buf.size = encode_codepoint(cp, buf.data);
+  return buf;
+}
+
 // 将单个 Unicode 码点（char32_t）编码为 UTF-8 字符串。
 inline std::string encode_codepoint(char32_t cp) {
   char buff[4];
@@ -158,9 +316,162 @@ inline std::string encode_codepoint(char32_t cp) {
   return std::string(buff, l);
 }
 
+namespace detail {
+
+// 与 encode_codepoint 一致：代理区和超过 U+10FFFF 的码点长度为 0。
+inline size_t encode_length_scalar(const char32_t* s32, size_t n) {
+  size_t len = 0;
+  for (size_t i = 0; i < n; i++) {
+    auto cp = static_cast<uint32_t>(s32[i]);
+    auto valid = (cp - 0xD800 >= 0x800) & (cp < 0x110000);
+    len += (1 + (cp >= 0x80) + (cp >= 0x800) + (cp >= 0x10000)) * valid;
+  }
+  return len;
+}
+
+#ifdef PEG_USE_X86_SIMD
+// SSE2/AVX2 只有有符号比较，先把两边都异或 0x80000000 转成无符号比较。
+// 比较结果为 -1，因此长度为 1 减去各比较结果之和。每 65536 轮把 32 位
+// 累加器归约一次以免溢出。
+PEG_TARGET("sse2")
+inline size_t encode_length_sse2(const char32_t* s32, size_t n) {
+  const auto bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+  const auto one = _mm_set1_epi32(1);
+  const auto t1 = _mm_xor_si128(_mm_set1_epi32(0x7F), bias);
+  const auto t2 = _mm_xor_si128(_mm_set1_epi32(0x7FF), bias);
+  const auto t3 = _mm_xor_si128(_mm_set1_epi32(0xFFFF), bias);
+  const auto max = _mm_xor_si128(_mm_set1_epi32(0x10FFFF), bias);
+  const auto surrogate_base = _mm_set1_epi32(0xD800);
+  const auto surrogate_size = _mm_xor_si128(_mm_set1_epi32(0x800), bias);
+  size_t len = 0;
+  size_t i = 0;
+  while (i + 4 <= n) {
+    auto acc = _mm_setzero_si128();
+    for (size_t k = 0; k < 65536 && i + 4 <= n; k++, i += 4) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s32 + i));
+      auto x = _mm_xor_si128(v, bias);
+      auto l = _mm_sub_epi32(
+          one, _mm_add_epi32(_mm_add_epi32(_mm_cmpgt_epi32(x, t1),
+                                           _mm_cmpgt_epi32(x, t2)),
+                             _mm_cmpgt_epi32(x, t3)));
+      auto invalid = _mm_or_si128(
+          _mm_cmpgt_epi32(x, max),
+          _mm_cmpgt_epi32(
+              surrogate_size,
+              _mm_xor_si128(_mm_sub_epi32(v, surrogate_base), bias)));
+      acc = _mm_add_epi32(acc, _mm_andnot_si128(invalid, l));
+    }
+    alignas(16) uint32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    len += static_cast<size_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+  }
+  return len + encode_length_scalar(s32 + i, n - i);
+}
+
+PEG_TARGET("avx2")
+inline size_t encode_length_avx2(const char32_t* s32, size_t n) {
+  const auto bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+  const auto one = _mm256_set1_epi32(1);
+  const auto t1 = _mm256_xor_si256(_mm256_set1_epi32(0x7F), bias);
+  const auto t2 = _mm256_xor_si256(_mm256_set1_epi32(0x7FF), bias);
+  const auto t3 = _mm256_xor_si256(_mm256_set1_epi32(0xFFFF), bias);
+  const auto max = _mm256_xor_si256(_mm256_set1_epi32(0x10FFFF), bias);
+  const auto surrogate_base = _mm256_set1_epi32(0xD800);
+  const auto surrogate_size = _mm256_xor_si256(_mm256_set1_epi32(0x800), bias);
+  size_t len = 0;
+  size_t i = 0;
+  while (i + 8 <= n) {
+    auto acc = _mm256_setzero_si256();
+    for (size_t k = 0; k < 65536 && i + 8 <= n; k++, i += 8) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s32 + i));
+      auto x = _mm256_xor_si256(v, bias);
+      auto l = _mm256_sub_epi32(
+          one, _mm256_add_epi32(_mm256_add_epi32(_mm256_cmpgt_epi32(x, t1),
+                                                 _mm256_cmpgt_epi32(x, t2)),
+                                _mm256_cmpgt_epi32(x, t3)));
+      auto invalid = _mm256_or_si256(
+          _mm256_cmpgt_epi32(x, max),
+          _mm256_cmpgt_epi32(
+              surrogate_size,
+              _mm256_xor_si256(_mm256_sub_epi32(v, surrogate_base), bias)));
+      acc = _mm256_add_epi32(acc, _mm256_andnot_si256(invalid, l));
+    }
+    alignas(32) uint32_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    for (auto lane : lanes) {
+      len += lane;
+    }
+  }
+  return len + encode_length_scalar(s32 + i, n - i);
+}
+#endif
+
+}  // namespace detail
+
+// 计算将码点序列编码为 UTF-8 所需的字节数。被 encode_codepoint 拒绝的
+// 码点（代理区、超过 U+10FFFF）不计入长度。
+inline size_t encode_length(std::u32string_view s32) {
+  using Kernel = size_t (*)(const char32_t*, size_t);
+  static const Kernel kernel = []() -> Kernel {
+    switch (detail::simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+      case detail::SimdLevel::AVX512:
+      case detail::SimdLevel::AVX2: return detail::encode_length_avx2;
+      case detail::SimdLevel::SSSE3:
+      case detail::SimdLevel::SSE2: return detail::encode_length_sse2;
+#endif
+      default: return detail::encode_length_scalar;
+    }
+  }();
+  if (s32.size() < 8) {
+    return detail::encode_length_scalar(s32.data(), s32.size());
+  }
+  return kernel(s32.data(), s32.size());
+}
+
+// 将码点序列编码为 UTF-8 写入 buff，返回写入的字节数。len 为 buff 的大小，
+// 通常取 encode_length(s32)；空间不足时只写入能完整容纳的码点。
+// 与 encode_codepoint 一样，非法码点不产生输出。
+inline size_t encode_into(std::u32string_view s32, char* buff, size_t len) {
+  static constexpr uint8_t lead[4] = {0x00, 0xC0, 0xE0, 0xF0};
+  size_t pos = 0;
+  size_t i = 0;
+  // 剩余空间不少于 4 个字节时，每个码点都无分支地写入 4 个字节，
+  // 再按实际长度前移；多写的字节会被下一个码点覆盖。
+  for (; i < s32.size() && pos + 4 <= len; i++) {
+    auto cp = static_cast<uint32_t>(s32[i]);
+    uint32_t n = (cp >= 0x80) + (cp >= 0x800) + (cp >= 0x10000);
+    uint32_t valid = (cp - 0xD800 >= 0x800) & (cp < 0x110000);
+    char b[4];
+    b[0] = static_cast<char>(lead[n] | (cp >> (6 * n)));
+    b[1] = static_cast<char>(0x80 | ((cp >> (6 * ((n - 1) & 3))) & 0x3F));
+    b[2] = static_cast<char>(0x80 | ((cp >> (6 * ((n - 2) & 3))) & 0x3F));
+    b[3] = static_cast<char>(0x80 | ((cp >> (6 * ((n - 3) & 3))) & 0x3F));
+    std::memcpy(buff + pos, b, 4);
+    pos += (n + 1) * valid;
+  }
+  for (; i < s32.size(); i++) {
+    char b[4];
+    auto l = encode_codepoint(s32[i], b);
+    if (pos + l > len) {
+      break;
+    }
+    std::memcpy(buff + pos, b, l);
+    pos += l;
+  }
+  return pos;
+}
+
+// 将码点序列编码为 UTF-8 字符串。
+inline std::string encode(std::u32string_view s32) {
+  std::string out(encode_length(s32), '\0');
+  encode_into(s32, out.data(), out.size());
+  return out;
+}
+
 // 将 UTF-8 编码的字符串解码为单个 Unicode 码点。
-inline bool decode_codepoint(const char* s8, size_t l, size_t& bytes,
-                             char32_t& cp) {
+constexpr bool decode_codepoint(const char* s8, size_t l, size_t& bytes,
+                                char32_t& cp) {
   if (l) {
     auto b = static_cast<uint8_t>(s8[0]);
     if ((b & 0x80) == 0) {
@@ -196,260 +507,3860 @@ inline bool decode_codepoint(const char* s8, size_t l, size_t& bytes,
   return false;
 }
 
-inline size_t decode_codepoint(const char* s8, size_t l, char32_t& cp) {
-  size_t bytes;
+constexpr size_t decode_codepoint(const char* s8, size_t l, char32_t& cp) {
+  size_t bytes = 0;
   if (decode_codepoint(s8, l, bytes, cp)) {
     return bytes;
   }
   return 0;
 }
 
-inline char32_t decode_codepoint(const char* s8, size_t l) {
+constexpr char32_t decode_codepoint(const char* s8, size_t l) {
   char32_t cp = 0;
   decode_codepoint(s8, l, cp);
   return cp;
 }
 
-// 将完整的 UTF-8 编码字符串解码为 Unicode 码点序列。
-inline std::u32string decode(const char* s8, size_t l) {
-  std::u32string out;
-  size_t i = 0;
-  while (i < l) {
-    auto beg = i++;
-    while (i < l && (s8[i] & 0xc0) == 0x80) {
-      i++;
+// 严格解码 UTF-8 编码字符串中的第一个码点，同时检查 continuation 字节、
+// overlong 编码、代理区（U+D800-U+DFFF）以及超过 U+10FFFF 的码点。
+// 合法时 bytes 为序列长度；非法时返回 false，bytes 为应当跳过的字节数，
+// 即 Unicode 标准所说的最大非法子部分（maximal subpart），至少为 1。
+constexpr bool decode_codepoint_strict(const char* s8, size_t l, size_t& bytes,
+                                       char32_t& cp) {
+  if (!l) {
+    bytes = 0;
+    return false;
+  }
+  auto b = static_cast<uint8_t>(s8[0]);
+  if (b < 0x80) {
+    bytes = 1;
+    cp = b;
+    return true;
+  }
+  size_t len = 0;
+  char32_t c = 0;
+  // 第二个字节的合法范围取决于首字节。
+  uint8_t lo = 0x80;
+  uint8_t hi = 0xBF;
+  if (0xC2 <= b && b <= 0xDF) {
+    len = 2;
+    c = b & 0x1F;
+  } else if (0xE0 <= b && b <= 0xEF) {
+    len = 3;
+    c = b & 0x0F;
+    if (b == 0xE0) {
+      lo = 0xA0;
+    } else if (b == 0xED) {
+      hi = 0x9F;
+    }
+  } else if (0xF0 <= b && b <= 0xF4) {
+    len = 4;
+    c = b & 0x07;
+    if (b == 0xF0) {
+      lo = 0x90;
+    } else if (b == 0xF4) {
+      hi = 0x8F;
+    }
+  } else {
+    bytes = 1;
+    return false;
+  }
+  for (size_t k = 1; k < len; k++) {
+    if (k == l) {
+      bytes = k;
+      return false;
     }
-    out += decode_codepoint(&s8[beg], (i - beg));
+    auto t = static_cast<uint8_t>(s8[k]);
+    if (t < lo || hi < t) {
+      bytes = k;
+      return false;
+    }
+    c = (c << 6) | (t & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
   }
-  return out;
+  bytes = len;
+  cp = c;
+  return true;
 }
 
-template <typename T>
-const char* u8(const T* s) {
-  return reinterpret_cast<const char*>(s);
+// 计算 UTF-8 编码字符串中结束于 s8 + l 的那个码点的字节长度，用于向后
+// 移动。最多回退 3 个 continuation 字节找到首字节；若从该首字节开始
+// decode_codepoint_strict 恰好消耗到 s8 + l，返回这段长度，否则最后一个
+// 字节是孤立的 continuation 字节，返回 1。这与向前逐个解码时的切分一致，
+// 非法输入也不例外。l 为 0 时返回 0。
+constexpr size_t prev_codepoint_length(const char* s8, size_t l) {
+  if (!l) {
+    return 0;
+  }
+  size_t k = 1;
+  while (k < 4 && k < l && (static_cast<uint8_t>(s8[l - k]) & 0xC0) == 0x80) {
+    k++;
+  }
+  size_t bytes = 0;
+  char32_t cp = 0;
+  decode_codepoint_strict(s8 + l - k, k, bytes, cp);
+  return bytes == k ? k : 1;
 }
 
-/*-----------------------------------------------------------------------------
- *  escape_characters
- *---------------------------------------------------------------------------*/
+// 解码结束于 s8 + l 的码点。bytes 为其长度；非法序列返回 false。
+constexpr bool decode_codepoint_backward(const char* s8, size_t l,
+                                         size_t& bytes, char32_t& cp) {
+  bytes = prev_codepoint_length(s8, l);
+  size_t len = 0;
+  return bytes && decode_codepoint_strict(s8 + l - bytes, bytes, len, cp);
+}
 
-// 将字符串中的特殊字符转换为它们的转义序列表示。
-inline std::string escape_characters(const char *s, size_t n) {
-  std::string str;
-  for (size_t i = 0; i < n; i++) {
-    auto c = s[i];
-    switch (c) {
-    case '\f': str += "\\f"; break;
-    case '\n': str += "\\n"; break;
-    case '\r': str += "\\r"; break;
-    case '\t': str += "\\t"; break;
-    case '\v': str += "\\v"; break;
-    default: str += c; break;
+// 按码点遍历 UTF-8 字符串的双向迭代器。非法序列按
+// decode_codepoint_strict 的最大非法子部分切分，解引用得到 U+FFFD。
+class CodepointIterator {
+ public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using value_type = char32_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = void;
+  using reference = char32_t;
+
+  CodepointIterator() = default;
+  CodepointIterator(std::string_view sv, size_t pos)
+      : s_(sv.data()), n_(sv.size()), pos_(pos) {}
+
+  char32_t operator*() const {
+    auto b = static_cast<uint8_t>(s_[pos_]);
+    if (b < 0x80) {
+      return b;
     }
+    size_t bytes;
+    char32_t cp;
+    return decode_codepoint_strict(s_ + pos_, n_ - pos_, bytes, cp) ? cp
+                                                                    : 0xFFFD;
   }
-  return str;
-}
 
-inline std::string escape_characters(std::string_view sv) {
-  return escape_characters(sv.data(), sv.size());
-}
+  CodepointIterator& operator++() {
+    if (static_cast<uint8_t>(s_[pos_]) < 0x80) {
+      pos_++;
+    } else {
+      size_t bytes;
+      char32_t cp;
+      decode_codepoint_strict(s_ + pos_, n_ - pos_, bytes, cp);
+      pos_ += bytes;
+    }
+    return *this;
+  }
 
-/*-----------------------------------------------------------------------------
- *  resolve_escape_sequence
- *---------------------------------------------------------------------------*/
+  CodepointIterator operator++(int) {
+    auto it = *this;
+    ++*this;
+    return it;
+  }
 
-inline bool is_hex(char c, int &v) {
-  if ('0' <= c && c <= '9') {
-    v = c - '0';
-    return true;
-  } else if ('a' <= c && c <= 'f') {
-    v = c - 'a' + 10;
-    return true;
-  } else if ('A' <= c && c <= 'F') {
-    v = c - 'A' + 10;
-    return true;
+  CodepointIterator& operator--() {
+    if (static_cast<uint8_t>(s_[pos_ - 1]) < 0x80) {
+      pos_--;
+    } else {
+      pos_ -= prev_codepoint_length(s_, pos_);
+    }
+    return *this;
   }
-  return false;
-}
 
-inline bool is_digit(char c, int &v) {
-  if ('0' <= c && c <= '9') {
-    v = c - '0';
-    return true;
+  CodepointIterator operator--(int) {
+    auto it = *this;
+    --*this;
+    return it;
   }
-  return false;
-}
 
-inline std::pair<int, size_t> parse_hex_number(const char *s, size_t n,
-                                               size_t i) {
-  int ret = 0;
-  int val;
-  while (i < n && is_hex(s[i], val)) {
-    ret = static_cast<int>(ret * 16 + val);
-    i++;
+  // 当前码点在字符串中的字节偏移。
+  size_t position() const { return pos_; }
+
+  friend bool operator==(const CodepointIterator& a,
+                         const CodepointIterator& b) {
+    return a.s_ == b.s_ && a.pos_ == b.pos_;
   }
-  return std::pair(ret, i);
-}
 
-inline std::pair<int, size_t> parse_octal_number(const char *s, size_t n,
-                                                 size_t i) {
-  int ret = 0;
-  int val;
-  while (i < n && is_digit(s[i], val)) {
-    ret = static_cast<int>(ret * 8 + val);
-    i++;
+  friend bool operator!=(const CodepointIterator& a,
+                         const CodepointIterator& b) {
+    return !(a == b);
   }
-  return std::pair(ret, i);
-}
 
-// 解析包含转义序列的字符串，并将这些序列转换回它们对应的字符。
-inline std::string resolve_escape_sequence(const char *s, size_t n) {
-  std::string r;
-  r.reserve(n);
+ private:
+  const char* s_ = nullptr;
+  size_t n_ = 0;
+  size_t pos_ = 0;
+};
 
-  size_t i = 0;
-  while (i < n) {
-    auto ch = s[i];
-    if (ch == '\\') {
-      i++;
-      if (i == n) { throw std::runtime_error("Invalid escape sequence..."); }
-      switch (s[i]) {
-      case 'f':
-        r += '\f';
-        i++;
-        break;
-      case 'n':
-        r += '\n';
-        i++;
-        break;
-      case 'r':
-        r += '\r';
-        i++;
-        break;
-      case 't':
-        r += '\t';
-        i++;
-        break;
-      case 'v':
-        r += '\v';
-        i++;
-        break;
-      case '\'':
-        r += '\'';
-        i++;
-        break;
-      case '"':
-        r += '"';
-        i++;
-        break;
-      case '[':
-        r += '[';
-        i++;
-        break;
-      case ']':
-        r += ']';
-        i++;
-        break;
-      case '\\':
-        r += '\\';
-        i++;
-        break;
-      case 'x':
-      case 'u': {
-        char32_t cp;
-        std::tie(cp, i) = parse_hex_number(s, n, i + 1);
-        r += encode_codepoint(cp);
-        break;
-      }
-      default: {
-        char32_t cp;
-        std::tie(cp, i) = parse_octal_number(s, n, i);
-        r += encode_codepoint(cp);
-        break;
-      }
+// 把 std::string_view 当作码点序列遍历，例如 for (auto cp : codepoints(sv))。
+class Codepoints {
+ public:
+  explicit Codepoints(std::string_view sv) : sv_(sv) {}
+
+  CodepointIterator begin() const { return CodepointIterator(sv_, 0); }
+  CodepointIterator end() const { return CodepointIterator(sv_, sv_.size()); }
+
+ private:
+  std::string_view sv_;
+};
+
+inline Codepoints codepoints(std::string_view sv) { return Codepoints(sv); }
+
+namespace detail {
+
+// 从 i 开始逐个码点严格检查，返回第一个非法序列的偏移；全部合法时返回 l。
+inline size_t validate_utf8_scalar(const char* s8, size_t l, size_t i) {
+  while (i < l) {
+    if (i + 8 <= l) {
+      uint64_t w;
+      std::memcpy(&w, s8 + i, 8);
+      if ((w & 0x8080808080808080ULL) == 0) {
+        i += 8;
+        continue;
       }
-    } else {
-      r += ch;
-      i++;
     }
+    size_t bytes;
+    char32_t cp;
+    if (!decode_codepoint_strict(s8 + i, l - i, bytes, cp)) {
+      return i;
+    }
+    i += bytes;
   }
-  return r;
+  return l;
 }
 
-/*-----------------------------------------------------------------------------
- *  token_to_number_ - This function should be removed eventually
- *---------------------------------------------------------------------------*/
+#ifdef PEG_USE_X86_SIMD
+// Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte"。
+// 用前一字节的高/低半字节和当前字节的高半字节查三张 16 项的表，三者按位与
+// 后非零即表示这一对字节构成错误；3/4 字节序列的后续 continuation 字节另行
+// 检查。下面每一位表示一类错误。
+namespace utf8_lookup {
+enum : uint8_t {
+  TooShort = 1 << 0,      // 首字节后面跟的不是 continuation 字节
+  TooLong = 1 << 1,       // ASCII 后面跟了 continuation 字节
+  Overlong3 = 1 << 2,     // 11100000 100_____
+  TooLarge = 1 << 3,      // 11110100 1001____ 及以上
+  Surrogate = 1 << 4,     // 11101101 101_____
+  Overlong2 = 1 << 5,     // 1100000_
+  TooLarge1000 = 1 << 6,  // 11110101 及以上
+  Overlong4 = 1 << 6,     // 11110000 1000____
+  TwoConts = 1 << 7,      // 两个连续的 continuation 字节
+  Carry = TooShort | TooLong | TwoConts,
+};
 
-// 将字符串转换为数字。
-template <typename T> T token_to_number_(std::string_view sv) {
-  T n = 0;
-#if __has_include(<charconv>)
-  if constexpr (!std::is_floating_point<T>::value) {
-    std::from_chars(sv.data(), sv.data() + sv.size(), n);
-#else
-  if constexpr (false) {
-#endif
-  } else {
-    auto s = std::string(sv);
-    std::istringstream ss(s);
-    ss >> n;
+alignas(16) constexpr uint8_t byte_1_high[16] = {
+    TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+    TwoConts, TwoConts, TwoConts, TwoConts,
+    TooShort | Overlong2,
+    TooShort,
+    TooShort | Overlong3 | Surrogate,
+    TooShort | TooLarge | TooLarge1000 | Overlong4,
+};
+
+alignas(16) constexpr uint8_t byte_1_low[16] = {
+    Carry | Overlong3 | Overlong2 | Overlong4,
+    Carry | Overlong2,
+    Carry,
+    Carry,
+    Carry | TooLarge,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000 | Surrogate,
+    Carry | TooLarge | TooLarge1000,
+    Carry | TooLarge | TooLarge1000,
+};
+
+alignas(16) constexpr uint8_t byte_2_high[16] = {
+    TooShort, TooShort, TooShort, TooShort,
+    TooShort, TooShort, TooShort, TooShort,
+    TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4,
+    TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+    TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+    TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+    TooShort, TooShort, TooShort, TooShort,
+};
+}  // namespace utf8_lookup
+
+// 以下内核只处理完整的块，返回第一个出错块的起始偏移（或已处理的长度）。
+// 该偏移之前的数据除了末尾可能未完成的序列外都已确认合法。
+PEG_TARGET("ssse3")
+inline size_t validate_utf8_ssse3(const char* s8, size_t l) {
+  using namespace utf8_lookup;
+  const auto t1h =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_high));
+  const auto t1l = _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_low));
+  const auto t2h =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(byte_2_high));
+  const auto nibble = _mm_set1_epi8(0x0F);
+  const auto zero = _mm_setzero_si128();
+  // 块末尾 3 个字节若是尚未结束的多字节序列的首字节，下一块必须续上。
+  const auto max_value = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                       -1, -1, -1, static_cast<char>(0xEF),
+                                       static_cast<char>(0xDF),
+                                       static_cast<char>(0xBF));
+  auto prev_input = zero;
+  auto prev_incomplete = zero;
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s8 + i));
+    __m128i error;
+    if (_mm_movemask_epi8(input) == 0) {
+      error = prev_incomplete;
+      prev_incomplete = zero;
+    } else {
+      auto prev1 = _mm_alignr_epi8(input, prev_input, 15);
+      auto prev2 = _mm_alignr_epi8(input, prev_input, 14);
+      auto prev3 = _mm_alignr_epi8(input, prev_input, 13);
+      auto sc = _mm_and_si128(
+          _mm_and_si128(
+              _mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4),
+                                                  nibble)),
+              _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nibble))),
+          _mm_shuffle_epi8(t2h,
+                           _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+      // 3/4 字节序列的第 3、4 个字节必须是 continuation 字节。
+      auto is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+      auto is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+      auto must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth),
+                                  _mm_set1_epi8(static_cast<char>(0x80)));
+      error = _mm_xor_si128(must23, sc);
+      prev_incomplete = _mm_subs_epu8(input, max_value);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF) {
+      return i;
+    }
+    prev_input = input;
   }
-  return n;
+  return i;
 }
 
-/*-----------------------------------------------------------------------------
- *  Trie
- *---------------------------------------------------------------------------*/
-
-class Trie {
-public:
-  Trie() = default;
-  Trie(const Trie &) = default;
+PEG_TARGET("avx2")
+inline size_t validate_utf8_avx2(const char* s8, size_t l) {
+  using namespace utf8_lookup;
+  const auto t1h = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_high)));
+  const auto t1l = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(byte_1_low)));
+  const auto t2h = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(byte_2_high)));
+  const auto nibble = _mm256_set1_epi8(0x0F);
+  const auto zero = _mm256_setzero_si256();
+  const auto max_value = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, static_cast<char>(0xEF),
+      static_cast<char>(0xDF), static_cast<char>(0xBF));
+  auto prev_input = zero;
+  auto prev_incomplete = zero;
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    auto input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s8 + i));
+    __m256i error;
+    if (_mm256_movemask_epi8(input) == 0) {
+      error = prev_incomplete;
+      prev_incomplete = zero;
+    } else {
+      // 跨 128 位 lane 取前一个块的末尾字节。
+      auto carry = _mm256_permute2x128_si256(prev_input, input, 0x21);
+      auto prev1 = _mm256_alignr_epi8(input, carry, 15);
+      auto prev2 = _mm256_alignr_epi8(input, carry, 14);
+      auto prev3 = _mm256_alignr_epi8(input, carry, 13);
+      auto sc = _mm256_and_si256(
+          _mm256_and_si256(
+              _mm256_shuffle_epi8(
+                  t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+              _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble))),
+          _mm256_shuffle_epi8(
+              t2h, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+      auto is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+      auto is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+      auto must23 =
+          _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                           _mm256_set1_epi8(static_cast<char>(0x80)));
+      error = _mm256_xor_si256(must23, sc);
+      prev_incomplete = _mm256_subs_epu8(input, max_value);
+    }
+    if (!_mm256_testz_si256(error, error)) {
+      return i;
+    }
+    prev_input = input;
+  }
+  return i;
+}
+#endif
 
-  Trie(const std::vector<std::string> &items) {
-    for (const auto &item : items) {
-      for (size_t len = 1; len <= item.size(); len++) {
-        auto last = len == item.size();
-        std::string_view sv(item.data(), len);
-        auto it = dic_.find(sv);
-        if (it == dic_.end()) {
-          dic_.emplace(sv, Info{last, last});
-        } else if (last) {
-          it->second.match = true;
-        } else {
-          it->second.done = false;
-        }
+// 从 SIMD 内核返回的偏移 i 继续检查：先退回到可能跨越块边界的多字节序列
+// 的首字节，再由标量代码给出精确的偏移。
+inline size_t validate_utf8_resume(const char* s8, size_t l, size_t i) {
+  for (size_t k = 1; k <= 3 && k <= i; k++) {
+    auto b = static_cast<uint8_t>(s8[i - k]);
+    if ((b & 0xC0) != 0x80) {
+      if (b >= 0xC0) {
+        i -= k;
       }
+      break;
     }
   }
+  return validate_utf8_scalar(s8, l, i);
+}
 
-  size_t match(const char *text, size_t text_len) const {
-    size_t match_len = 0;
-    auto done = false;
-    size_t len = 1;
-    while (!done && len <= text_len) {
-      std::string_view sv(text, len);
-      auto it = dic_.find(sv);
-      if (it == dic_.end()) {
-        done = true;
-      } else {
-        if (it->second.match) { match_len = len; }
-        if (it->second.done) { done = true; }
-      }
-      len += 1;
+}  // namespace detail
+
+// 检查整个缓冲区是否为合法的 UTF-8，返回第一个非法序列的字节偏移；
+// 全部合法时返回 l。SIMD 内核只负责定位出错的块，精确的偏移由标量代码给出。
+inline size_t validate_utf8(const char* s8, size_t l) {
+  using Kernel = size_t (*)(const char*, size_t);
+  static const Kernel kernel = []() -> Kernel {
+    switch (detail::simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+      case detail::SimdLevel::AVX512:
+      case detail::SimdLevel::AVX2: return detail::validate_utf8_avx2;
+      case detail::SimdLevel::SSSE3: return detail::validate_utf8_ssse3;
+#endif
+      default: return nullptr;
     }
-    return match_len;
+  }();
+  if (kernel && l >= 64) {
+    return detail::validate_utf8_resume(s8, l, kernel(s8, l));
   }
+  return detail::validate_utf8_scalar(s8, l, 0);
+}
 
-private:
-  struct Info {
-    bool done;
-    bool match;
-  };
+inline bool is_valid_utf8(const char* s8, size_t l) {
+  return validate_utf8(s8, l) == l;
+}
+
+// 表示输入已经通过 validate_utf8 检查。接受该标记的重载不再检查长度和
+// 字节模式，只适合在热路径上处理事先验证过的输入。
+struct Utf8ValidatedTag {
+  explicit Utf8ValidatedTag() = default;
+};
+inline constexpr Utf8ValidatedTag Utf8Validated{};
+
+constexpr size_t codepoint_length(Utf8ValidatedTag, const char* s8) {
+  auto b = static_cast<uint8_t>(s8[0]);
+  return 1 + (b >= 0xC0) + (b >= 0xE0) + (b >= 0xF0);
+}
+
+constexpr size_t decode_codepoint(Utf8ValidatedTag, const char* s8,
+                                  char32_t& cp) {
+  auto b = static_cast<char32_t>(static_cast<uint8_t>(s8[0]));
+  switch (codepoint_length(Utf8Validated, s8)) {
+    case 1: cp = b; return 1;
+    case 2:
+      cp = ((b & 0x1F) << 6) | (static_cast<char32_t>(s8[1] & 0x3F));
+      return 2;
+    case 3:
+      cp = ((b & 0x0F) << 12) | ((static_cast<char32_t>(s8[1] & 0x3F)) << 6) |
+           (static_cast<char32_t>(s8[2] & 0x3F));
+      return 3;
+    default:
+      cp = ((b & 0x07) << 18) | ((static_cast<char32_t>(s8[1] & 0x3F)) << 12) |
+           ((static_cast<char32_t>(s8[2] & 0x3F)) << 6) |
+           (static_cast<char32_t>(s8[3] & 0x3F));
+      return 4;
+  }
+}
+
+namespace detail {
+
+// 把开头连续的 ASCII 字节逐个扩展为 char32_t，返回处理的字节数。
+inline size_t widen_ascii_scalar(const char* s8, size_t l, char32_t* out) {
+  size_t i = 0;
+  for (; i < l && static_cast<uint8_t>(s8[i]) < 0x80; i++) {
+    out[i] = static_cast<char32_t>(s8[i]);
+  }
+  return i;
+}
+
+#ifdef PEG_USE_X86_SIMD
+PEG_TARGET("sse2")
+inline size_t widen_ascii_sse2(const char* s8, size_t l, char32_t* out) {
+  const auto zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= l; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s8 + i));
+    if (_mm_movemask_epi8(v)) {
+      break;
+    }
+    auto lo = _mm_unpacklo_epi8(v, zero);
+    auto hi = _mm_unpackhi_epi8(v, zero);
+    auto dst = reinterpret_cast<__m128i*>(out + i);
+    _mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+  }
+  return i + widen_ascii_scalar(s8 + i, l - i, out + i);
+}
+
+PEG_TARGET("avx2")
+inline size_t widen_ascii_avx2(const char* s8, size_t l, char32_t* out) {
+  size_t i = 0;
+  for (; i + 32 <= l; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s8 + i));
+    if (_mm256_movemask_epi8(v)) {
+      break;
+    }
+    auto dst = reinterpret_cast<__m256i*>(out + i);
+    for (int k = 0; k < 4; k++) {
+      auto bytes =
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s8 + i + k * 8));
+      _mm256_storeu_si256(dst + k, _mm256_cvtepu8_epi32(bytes));
+    }
+  }
+  return i + widen_ascii_scalar(s8 + i, l - i, out + i);
+}
+#endif
+
+inline size_t widen_ascii(const char* s8, size_t l, char32_t* out) {
+  using Kernel = size_t (*)(const char*, size_t, char32_t*);
+  static const Kernel kernel = []() -> Kernel {
+    switch (simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+      case SimdLevel::AVX512:
+      case SimdLevel::AVX2: return widen_ascii_avx2;
+      case SimdLevel::SSSE3:
+      case SimdLevel::SSE2: return widen_ascii_sse2;
+#endif
+      default: return widen_ascii_scalar;
+    }
+  }();
+  if (l < 16) {
+    return widen_ascii_scalar(s8, l, out);
+  }
+  return kernel(s8, l, out);
+}
+
+}  // namespace detail
+
+// 解码时遇到非法 UTF-8 序列的处理方式。
+enum class Utf8ErrorPolicy {
+  Replace,  // 每个最大非法子部分替换为一个 U+FFFD
+  Stop,     // 在第一个非法序列处停止
+};
+
+struct DecodeResult {
+  size_t count;  // 写入输出缓冲区的码点数量
+  size_t error;  // 第一个非法序列的字节偏移，没有错误时等于输入长度
+};
+
+// 计算以 Utf8ErrorPolicy::Replace 解码时输出的码点数量，用于预先分配
+// decode_into 的输出缓冲区。合法部分用 SIMD 计数，非法部分之后逐个扫描。
+inline size_t decode_length(const char* s8, size_t l) {
+  auto i = validate_utf8(s8, l);
+  auto count = codepoint_count(s8, i);
+  while (i < l) {
+    size_t bytes;
+    char32_t cp;
+    decode_codepoint_strict(s8 + i, l - i, bytes, cp);
+    i += bytes;
+    count++;
+  }
+  return count;
+}
+
+// 将 UTF-8 编码字符串解码到调用者提供的缓冲区，不做任何内存分配。
+// out 至少要能容纳 decode_length(s8, l) 个码点。
+inline DecodeResult decode_into(
+    const char* s8, size_t l, char32_t* out,
+    Utf8ErrorPolicy policy = Utf8ErrorPolicy::Replace) {
+  DecodeResult ret{0, l};
+  size_t i = 0;
+  while (i < l) {
+    if (static_cast<uint8_t>(s8[i]) < 0x80) {
+      auto n = detail::widen_ascii(s8 + i, l - i, out + ret.count);
+      i += n;
+      ret.count += n;
+      continue;
+    }
+    size_t bytes;
+    char32_t cp;
+    if (!decode_codepoint_strict(s8 + i, l - i, bytes, cp)) {
+      if (ret.error == l) {
+        ret.error = i;
+      }
+      if (policy == Utf8ErrorPolicy::Stop) {
+        break;
+      }
+      cp = 0xFFFD;
+    }
+    out[ret.count++] = cp;
+    i += bytes;
+  }
+  return ret;
+}
+
+// 将完整的 UTF-8 编码字符串解码为 Unicode 码点序列。
+// 非法序列被替换为 U+FFFD。
+inline std::u32string decode(const char* s8, size_t l) {
+  std::u32string out(decode_length(s8, l), U'\0');
+  decode_into(s8, l, out.data());
+  return out;
+}
+
+// 增量 UTF-8 解码器，用于逐块到达的输入。块末尾未完成的多字节序列
+// （1 到 3 个字节）会被暂存，与下一次 feed() 的数据拼接后再解码，
+// 因此逐块解码的结果与对整个输入调用 decode 相同。非法序列替换为 U+FFFD。
+class Utf8Decoder {
+ public:
+  // 解码一块输入，返回写入 out 的码点数量。out 至少要能容纳 l + 1 个码点。
+  size_t feed(const char* s8, size_t l, char32_t* out) {
+    size_t n = 0;
+    size_t i = 0;
+    while (pending_len_ && i < l) {
+      pending_[pending_len_++] = s8[i++];
+      size_t bytes;
+      char32_t cp;
+      if (decode_codepoint_strict(pending_, pending_len_, bytes, cp)) {
+        out[n++] = cp;
+        pending_len_ = 0;
+      } else if (!is_truncated(pending_, pending_len_, bytes)) {
+        // 暂存的字节是合法前缀，所以出错的只能是刚追加的字节，
+        // 它要作为新序列的开头重新解码。
+        out[n++] = 0xFFFD;
+        errors_++;
+        pending_len_ = 0;
+        i--;
+      }
+    }
+    while (i < l) {
+      if (static_cast<uint8_t>(s8[i]) < 0x80) {
+        auto k = detail::widen_ascii(s8 + i, l - i, out + n);
+        i += k;
+        n += k;
+        continue;
+      }
+      size_t bytes;
+      char32_t cp;
+      if (!decode_codepoint_strict(s8 + i, l - i, bytes, cp)) {
+        if (is_truncated(s8 + i, l - i, bytes)) {
+          std::memcpy(pending_, s8 + i, bytes);
+          pending_len_ = bytes;
+          break;
+        }
+        cp = 0xFFFD;
+        errors_++;
+      }
+      out[n++] = cp;
+      i += bytes;
+    }
+    return n;
+  }
+
+  // 解码一块输入并追加到 out。
+  void feed(const char* s8, size_t l, std::u32string& out) {
+    auto n = out.size();
+    out.resize(n + l + 1);
+    out.resize(n + feed(s8, l, out.data() + n));
+  }
+
+  // 输入结束。若还有未完成的序列，向 out 写入一个 U+FFFD 并返回 1。
+  size_t finish(char32_t* out) {
+    if (!pending_len_) {
+      return 0;
+    }
+    out[0] = 0xFFFD;
+    errors_++;
+    pending_len_ = 0;
+    return 1;
+  }
+
+  void reset() {
+    pending_len_ = 0;
+    errors_ = 0;
+  }
+
+  // 暂存的未完成序列的字节数。
+  size_t pending() const { return pending_len_; }
+
+  // 到目前为止替换为 U+FFFD 的非法序列数量。
+  size_t errors() const { return errors_; }
+
+ private:
+  // 判断 decode_codepoint_strict 的失败是否仅仅因为输入在序列中途结束。
+  static bool is_truncated(const char* s8, size_t l, size_t bytes) {
+    if (bytes != l) {
+      return false;
+    }
+    auto b = static_cast<uint8_t>(s8[0]);
+    size_t len = (0xC2 <= b && b <= 0xDF)   ? 2
+                 : (0xE0 <= b && b <= 0xEF) ? 3
+                 : (0xF0 <= b && b <= 0xF4) ? 4
+                                            : 0;
+    return l < len;
+  }
+
+  char pending_[4] = {};
+  size_t pending_len_ = 0;
+  size_t errors_ = 0;
+};
+
+// 在编译期把 UTF-8 字面量解码为定长的码点数组，N 为数组容量，多余的
+// 元素为 0，非法序列为 U+FFFD。例如
+//   constexpr auto greek = decode_literal<2>(u8"αω");
+template <size_t N>
+constexpr std::array<char32_t, N> decode_literal(std::string_view s8) {
+  std::array<char32_t, N> out{};
+  size_t i = 0;
+  size_t n = 0;
+  while (i < s8.size() && n < N) {
+    size_t bytes = 0;
+    char32_t cp = 0;
+    if (!decode_codepoint_strict(s8.data() + i, s8.size() - i, bytes, cp)) {
+      cp = 0xFFFD;
+    }
+    out[n++] = cp;
+    i += bytes;
+  }
+  return out;
+}
+
+namespace detail {
+
+// Unicode 简单大小写折叠（CaseFolding.txt 中 C 和 S 两类映射），按区间
+// 保存：[first, last] 中每隔 step 个码点的一个码点折叠为 cp + delta。
+struct CaseFoldRange {
+  char32_t first;
+  char32_t last;
+  int32_t delta;
+  uint8_t step;
+};
+
+inline constexpr CaseFoldRange CaseFoldRanges[] = {
+    {0x0041, 0x005A, 32, 1}, {0x00B5, 0x00B5, 775, 1}, {0x00C0, 0x00D6, 32, 1},
+    {0x00D8, 0x00DE, 32, 1}, {0x0100, 0x012E, 1, 2}, {0x0132, 0x0136, 1, 2},
+    {0x0139, 0x0147, 1, 2}, {0x014A, 0x0176, 1, 2}, {0x0178, 0x0178, -121, 1},
+    {0x0179, 0x017D, 1, 2}, {0x017F, 0x017F, -268, 1}, {0x0181, 0x0181, 210, 1},
+    {0x0182, 0x0184, 1, 2}, {0x0186, 0x0186, 206, 1}, {0x0187, 0x0187, 1, 1},
+    {0x0189, 0x018A, 205, 1}, {0x018B, 0x018B, 1, 1}, {0x018E, 0x018E, 79, 1},
+    {0x018F, 0x018F, 202, 1}, {0x0190, 0x0190, 203, 1}, {0x0191, 0x0191, 1, 1},
+    {0x0193, 0x0193, 205, 1}, {0x0194, 0x0194, 207, 1},
+    {0x0196, 0x0196, 211, 1}, {0x0197, 0x0197, 209, 1}, {0x0198, 0x0198, 1, 1},
+    {0x019C, 0x019C, 211, 1}, {0x019D, 0x019D, 213, 1},
+    {0x019F, 0x019F, 214, 1}, {0x01A0, 0x01A4, 1, 2}, {0x01A6, 0x01A6, 218, 1},
+    {0x01A7, 0x01A7, 1, 1}, {0x01A9, 0x01A9, 218, 1}, {0x01AC, 0x01AC, 1, 1},
+    {0x01AE, 0x01AE, 218, 1}, {0x01AF, 0x01AF, 1, 1}, {0x01B1, 0x01B2, 217, 1},
+    {0x01B3, 0x01B5, 1, 2}, {0x01B7, 0x01B7, 219, 1}, {0x01B8, 0x01B8, 1, 1},
+    {0x01BC, 0x01BC, 1, 1}, {0x01C4, 0x01C4, 2, 1}, {0x01C5, 0x01C5, 1, 1},
+    {0x01C7, 0x01C7, 2, 1}, {0x01C8, 0x01C8, 1, 1}, {0x01CA, 0x01CA, 2, 1},
+    {0x01CB, 0x01DB, 1, 2}, {0x01DE, 0x01EE, 1, 2}, {0x01F1, 0x01F1, 2, 1},
+    {0x01F2, 0x01F4, 1, 2}, {0x01F6, 0x01F6, -97, 1}, {0x01F7, 0x01F7, -56, 1},
+    {0x01F8, 0x021E, 1, 2}, {0x0220, 0x0220, -130, 1}, {0x0222, 0x0232, 1, 2},
+    {0x023A, 0x023A, 10795, 1}, {0x023B, 0x023B, 1, 1},
+    {0x023D, 0x023D, -163, 1}, {0x023E, 0x023E, 10792, 1},
+    {0x0241, 0x0241, 1, 1}, {0x0243, 0x0243, -195, 1}, {0x0244, 0x0244, 69, 1},
+    {0x0245, 0x0245, 71, 1}, {0x0246, 0x024E, 1, 2}, {0x0345, 0x0345, 116, 1},
+    {0x0370, 0x0372, 1, 2}, {0x0376, 0x0376, 1, 1}, {0x037F, 0x037F, 116, 1},
+    {0x0386, 0x0386, 38, 1}, {0x0388, 0x038A, 37, 1}, {0x038C, 0x038C, 64, 1},
+    {0x038E, 0x038F, 63, 1}, {0x0391, 0x03A1, 32, 1}, {0x03A3, 0x03AB, 32, 1},
+    {0x03C2, 0x03C2, 1, 1}, {0x03CF, 0x03CF, 8, 1}, {0x03D0, 0x03D0, -30, 1},
+    {0x03D1, 0x03D1, -25, 1}, {0x03D5, 0x03D5, -15, 1},
+    {0x03D6, 0x03D6, -22, 1}, {0x03D8, 0x03EE, 1, 2}, {0x03F0, 0x03F0, -54, 1},
+    {0x03F1, 0x03F1, -48, 1}, {0x03F4, 0x03F4, -60, 1},
+    {0x03F5, 0x03F5, -64, 1}, {0x03F7, 0x03F7, 1, 1}, {0x03F9, 0x03F9, -7, 1},
+    {0x03FA, 0x03FA, 1, 1}, {0x03FD, 0x03FF, -130, 1}, {0x0400, 0x040F, 80, 1},
+    {0x0410, 0x042F, 32, 1}, {0x0460, 0x0480, 1, 2}, {0x048A, 0x04BE, 1, 2},
+    {0x04C0, 0x04C0, 15, 1}, {0x04C1, 0x04CD, 1, 2}, {0x04D0, 0x052E, 1, 2},
+    {0x0531, 0x0556, 48, 1}, {0x10A0, 0x10C5, 7264, 1},
+    {0x10C7, 0x10C7, 7264, 1}, {0x10CD, 0x10CD, 7264, 1},
+    {0x13F8, 0x13FD, -8, 1}, {0x1C80, 0x1C80, -6222, 1},
+    {0x1C81, 0x1C81, -6221, 1}, {0x1C82, 0x1C82, -6212, 1},
+    {0x1C83, 0x1C84, -6210, 1}, {0x1C85, 0x1C85, -6211, 1},
+    {0x1C86, 0x1C86, -6204, 1}, {0x1C87, 0x1C87, -6180, 1},
+    {0x1C88, 0x1C88, 35267, 1}, {0x1C90, 0x1CBA, -3008, 1},
+    {0x1CBD, 0x1CBF, -3008, 1}, {0x1E00, 0x1E94, 1, 2},
+    {0x1E9B, 0x1E9B, -58, 1}, {0x1E9E, 0x1E9E, -7615, 1},
+    {0x1EA0, 0x1EFE, 1, 2}, {0x1F08, 0x1F0F, -8, 1}, {0x1F18, 0x1F1D, -8, 1},
+    {0x1F28, 0x1F2F, -8, 1}, {0x1F38, 0x1F3F, -8, 1}, {0x1F48, 0x1F4D, -8, 1},
+    {0x1F59, 0x1F59, -8, 1}, {0x1F5B, 0x1F5B, -8, 1}, {0x1F5D, 0x1F5D, -8, 1},
+    {0x1F5F, 0x1F5F, -8, 1}, {0x1F68, 0x1F6F, -8, 1}, {0x1F88, 0x1F8F, -8, 1},
+    {0x1F98, 0x1F9F, -8, 1}, {0x1FA8, 0x1FAF, -8, 1}, {0x1FB8, 0x1FB9, -8, 1},
+    {0x1FBA, 0x1FBB, -74, 1}, {0x1FBC, 0x1FBC, -9, 1},
+    {0x1FBE, 0x1FBE, -7173, 1}, {0x1FC8, 0x1FCB, -86, 1},
+    {0x1FCC, 0x1FCC, -9, 1}, {0x1FD8, 0x1FD9, -8, 1}, {0x1FDA, 0x1FDB, -100, 1},
+    {0x1FE8, 0x1FE9, -8, 1}, {0x1FEA, 0x1FEB, -112, 1}, {0x1FEC, 0x1FEC, -7, 1},
+    {0x1FF8, 0x1FF9, -128, 1}, {0x1FFA, 0x1FFB, -126, 1},
+    {0x1FFC, 0x1FFC, -9, 1}, {0x2126, 0x2126, -7517, 1},
+    {0x212A, 0x212A, -8383, 1}, {0x212B, 0x212B, -8262, 1},
+    {0x2132, 0x2132, 28, 1}, {0x2160, 0x216F, 16, 1}, {0x2183, 0x2183, 1, 1},
+    {0x24B6, 0x24CF, 26, 1}, {0x2C00, 0x2C2F, 48, 1}, {0x2C60, 0x2C60, 1, 1},
+    {0x2C62, 0x2C62, -10743, 1}, {0x2C63, 0x2C63, -3814, 1},
+    {0x2C64, 0x2C64, -10727, 1}, {0x2C67, 0x2C6B, 1, 2},
+    {0x2C6D, 0x2C6D, -10780, 1}, {0x2C6E, 0x2C6E, -10749, 1},
+    {0x2C6F, 0x2C6F, -10783, 1}, {0x2C70, 0x2C70, -10782, 1},
+    {0x2C72, 0x2C72, 1, 1}, {0x2C75, 0x2C75, 1, 1}, {0x2C7E, 0x2C7F, -10815, 1},
+    {0x2C80, 0x2CE2, 1, 2}, {0x2CEB, 0x2CED, 1, 2}, {0x2CF2, 0x2CF2, 1, 1},
+    {0xA640, 0xA66C, 1, 2}, {0xA680, 0xA69A, 1, 2}, {0xA722, 0xA72E, 1, 2},
+    {0xA732, 0xA76E, 1, 2}, {0xA779, 0xA77B, 1, 2}, {0xA77D, 0xA77D, -35332, 1},
+    {0xA77E, 0xA786, 1, 2}, {0xA78B, 0xA78B, 1, 1}, {0xA78D, 0xA78D, -42280, 1},
+    {0xA790, 0xA792, 1, 2}, {0xA796, 0xA7A8, 1, 2}, {0xA7AA, 0xA7AA, -42308, 1},
+    {0xA7AB, 0xA7AB, -42319, 1}, {0xA7AC, 0xA7AC, -42315, 1},
+    {0xA7AD, 0xA7AD, -42305, 1}, {0xA7AE, 0xA7AE, -42308, 1},
+    {0xA7B0, 0xA7B0, -42258, 1}, {0xA7B1, 0xA7B1, -42282, 1},
+    {0xA7B2, 0xA7B2, -42261, 1}, {0xA7B3, 0xA7B3, 928, 1},
+    {0xA7B4, 0xA7C2, 1, 2}, {0xA7C4, 0xA7C4, -48, 1},
+    {0xA7C5, 0xA7C5, -42307, 1}, {0xA7C6, 0xA7C6, -35384, 1},
+    {0xA7C7, 0xA7C9, 1, 2}, {0xA7D0, 0xA7D0, 1, 1}, {0xA7D6, 0xA7D8, 1, 2},
+    {0xA7F5, 0xA7F5, 1, 1}, {0xAB70, 0xABBF, -38864, 1},
+    {0xFF21, 0xFF3A, 32, 1}, {0x10400, 0x10427, 40, 1},
+    {0x104B0, 0x104D3, 40, 1}, {0x10570, 0x1057A, 39, 1},
+    {0x1057C, 0x1058A, 39, 1}, {0x1058C, 0x10592, 39, 1},
+    {0x10594, 0x10595, 39, 1}, {0x10C80, 0x10CB2, 64, 1},
+    {0x118A0, 0x118BF, 32, 1}, {0x16E40, 0x16E5F, 32, 1},
+    {0x1E900, 0x1E921, 34, 1},
+};
+
+}  // namespace detail
+
+// 对码点做 Unicode 简单大小写折叠（一个码点折叠为一个码点，例如 'A' 折叠
+// 为 'a'，'Σ' 和 'ς' 都折叠为 'σ'），没有折叠的码点原样返回。
+constexpr char32_t fold_codepoint(char32_t cp) {
+  if (cp < 0x80) {
+    return 'A' <= cp && cp <= 'Z' ? cp + 32 : cp;
+  }
+  size_t lo = 0;
+  size_t hi = std::size(detail::CaseFoldRanges);
+  while (lo < hi) {
+    auto mid = (lo + hi) / 2;
+    if (detail::CaseFoldRanges[mid].last < cp) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == std::size(detail::CaseFoldRanges)) {
+    return cp;
+  }
+  const auto& r = detail::CaseFoldRanges[lo];
+  if (cp < r.first || (cp - r.first) % r.step) {
+    return cp;
+  }
+  return static_cast<char32_t>(static_cast<int32_t>(cp) + r.delta);
+}
+
+template <typename T>
+const char* u8(const T* s) {
+  return reinterpret_cast<const char*>(s);
+}
+
+/*-----------------------------------------------------------------------------
+ *  LineIndex
+ *---------------------------------------------------------------------------*/
+
+namespace detail {
+
+// 把 s[0, n) 中每个 '\n' 之后的偏移（即下一行的起始位置）追加到 starts。
+inline void scan_newlines_scalar(const char* s, size_t n,
+                                 std::vector<size_t>& starts, size_t base) {
+  auto p = s;
+  auto end = s + n;
+  while (p < end) {
+    auto q = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!q) {
+      break;
+    }
+    starts.push_back(base + (q - s) + 1);
+    p = q + 1;
+  }
+}
+
+#ifdef PEG_USE_X86_SIMD
+PEG_TARGET("sse2")
+inline void scan_newlines_sse2(const char* s, size_t n,
+                               std::vector<size_t>& starts, size_t base) {
+  const auto nl = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    while (mask) {
+      starts.push_back(base + i + __builtin_ctz(mask) + 1);
+      mask &= mask - 1;
+    }
+  }
+  scan_newlines_scalar(s + i, n - i, starts, base + i);
+}
+
+PEG_TARGET("avx2")
+inline void scan_newlines_avx2(const char* s, size_t n,
+                               std::vector<size_t>& starts, size_t base) {
+  const auto nl = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+    auto mask =
+        static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+    while (mask) {
+      starts.push_back(base + i + __builtin_ctz(mask) + 1);
+      mask &= mask - 1;
+    }
+  }
+  scan_newlines_scalar(s + i, n - i, starts, base + i);
+}
+#endif
+
+inline void scan_newlines(const char* s, size_t n,
+                          std::vector<size_t>& starts) {
+  using Kernel = void (*)(const char*, size_t, std::vector<size_t>&, size_t);
+  static const Kernel kernel = []() -> Kernel {
+    switch (simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+      case SimdLevel::AVX512:
+      case SimdLevel::AVX2: return scan_newlines_avx2;
+      case SimdLevel::SSSE3:
+      case SimdLevel::SSE2: return scan_newlines_sse2;
+#endif
+      default: return scan_newlines_scalar;
+    }
+  }();
+  kernel(s, n, starts, 0);
+}
+
+}  // namespace detail
+
+// 字节偏移到（行，列）的索引。构造时扫描一次换行符，之后每次查询只需
+// 二分查找所在的行，再在该行内统计码点数量。
+//
+// 指定 checkpoint_interval 时，额外记录每行起始处以及每隔
+// checkpoint_interval 字节处之前的码点数量，这样即使是很长的行
+// （例如压缩过的 JSON）也只需统计不超过 checkpoint_interval 个字节。
+//
+// LineIndex 不复制输入，输入必须在索引的生存期内保持有效。
+class LineIndex {
+ public:
+  LineIndex(const char* s, size_t n, size_t checkpoint_interval = 0)
+      : s_(s), n_(n), interval_(checkpoint_interval) {
+    starts_.push_back(0);
+    detail::scan_newlines(s, n, starts_);
+    if (interval_) {
+      build_checkpoints();
+    }
+  }
+
+  explicit LineIndex(std::string_view sv, size_t checkpoint_interval = 0)
+      : LineIndex(sv.data(), sv.size(), checkpoint_interval) {}
+
+  size_t line_count() const { return starts_.size(); }
+
+  // 第 line 行（从 1 开始）的起始字节偏移。
+  size_t line_start(size_t line) const { return starts_[line - 1]; }
+
+  // 返回 offset 所在的行号和列号，均从 1 开始，列号以码点计。
+  std::pair<size_t, size_t> line_info(size_t offset) const {
+    offset = std::min(offset, n_);
+    auto it = std::upper_bound(starts_.begin(), starts_.end(), offset);
+    auto line = static_cast<size_t>(it - starts_.begin());
+    auto start = *(it - 1);
+    if (!interval_ || offset - start <= interval_) {
+      return std::pair(line, codepoint_count(s_ + start, offset - start) + 1);
+    }
+    auto block = offset / interval_;
+    auto base = block * interval_;
+    auto before = blocks_[block] + codepoint_count(s_ + base, offset - base);
+    return std::pair(line, before - lines_[line - 1] + 1);
+  }
+
+  std::pair<size_t, size_t> line_info(const char* cur) const {
+    return line_info(static_cast<size_t>(cur - s_));
+  }
+
+ private:
+  // 按偏移顺序合并行起始位置和检查点位置，依次统计相邻位置之间的码点数，
+  // 整体只扫描输入一次。
+  void build_checkpoints() {
+    auto block_count = n_ / interval_ + 1;
+    blocks_.resize(block_count);
+    lines_.resize(starts_.size());
+    size_t count = 0;
+    size_t pos = 0;
+    size_t b = 0;
+    size_t l = 0;
+    while (b < block_count || l < starts_.size()) {
+      auto next_block = b < block_count ? b * interval_ : n_ + 1;
+      auto next_line = l < starts_.size() ? starts_[l] : n_ + 1;
+      auto next = std::min(next_block, next_line);
+      count += codepoint_count(s_ + pos, next - pos);
+      pos = next;
+      if (next == next_block) {
+        blocks_[b++] = count;
+      }
+      if (next == next_line) {
+        lines_[l++] = count;
+      }
+    }
+  }
+
+  const char* s_;
+  size_t n_;
+  size_t interval_;
+  std::vector<size_t> starts_;
+  std::vector<size_t> blocks_;  // [0, k * interval_) 内的码点数
+  std::vector<size_t> lines_;   // 每行起始位置之前的码点数
+};
+
+/*-----------------------------------------------------------------------------
+ *  CharacterSet
+ *---------------------------------------------------------------------------*/
+
+// 由码点区间构建的字符集合，例如 [a-zα-ω一-鿿]。判断一个码点是否属于
+// 集合不需要逐个比较区间：
+//   U+0000-U+00FF   256 位位图，一次读取；
+//   U+0100-U+FFFF   两级表，先以高 8 位查块号，再在 256 位的块中取位，
+//                   相同的块（全空、全满等）只保存一份；
+//   U+10000 以上    合并后的有序区间，二分查找。
+class CharacterSet {
+ public:
+  using Range = std::pair<char32_t, char32_t>;
+
+  CharacterSet() = default;
+
+  // ranges 中的区间为闭区间，可以无序、重叠。negated 为 true 时表示补集。
+  explicit CharacterSet(std::vector<Range> ranges, bool negated = false)
+      : negated_(negated) {
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<uint64_t> bits(0x10000 / 64);
+    for (const auto& [lo, hi] : ranges) {
+      if (lo > hi) {
+        continue;
+      }
+      if (lo < 0x10000) {
+        set_bits(bits.data(), lo, std::min<char32_t>(hi, 0xFFFF));
+      }
+      if (hi >= 0x10000) {
+        auto l = std::max<char32_t>(lo, 0x10000);
+        if (!astral_.empty() && l <= astral_.back().second + 1) {
+          astral_.back().second = std::max(astral_.back().second, hi);
+        } else {
+          astral_.emplace_back(l, hi);
+        }
+      }
+    }
+    std::copy(bits.begin(), bits.begin() + 4, latin1_);
+    // 第 0 块总是全空，未使用的高 8 位都指向它。
+    blocks_.assign(4, 0);
+    std::map<std::vector<uint64_t>, uint16_t> ids{
+        {std::vector<uint64_t>(4, 0), 0}};
+    for (size_t hi8 = 0; hi8 < 256; hi8++) {
+      std::vector<uint64_t> block(bits.begin() + hi8 * 4,
+                                  bits.begin() + hi8 * 4 + 4);
+      auto it = ids.find(block);
+      if (it == ids.end()) {
+        auto id = static_cast<uint16_t>(blocks_.size() / 4);
+        it = ids.emplace(block, id).first;
+        blocks_.insert(blocks_.end(), block.begin(), block.end());
+      }
+      index_[hi8] = it->second;
+    }
+  }
+
+  bool contains(char32_t cp) const {
+    bool found;
+    if (cp < 0x100) {
+      found = (latin1_[cp >> 6] >> (cp & 63)) & 1;
+    } else if (cp < 0x10000) {
+      auto block = index_[cp >> 8];
+      found = (blocks_[block * 4 + ((cp >> 6) & 3)] >> (cp & 63)) & 1;
+    } else {
+      auto it = std::upper_bound(
+          astral_.begin(), astral_.end(), cp,
+          [](char32_t c, const Range& r) { return c < r.first; });
+      found = it != astral_.begin() && cp <= (it - 1)->second;
+    }
+    return found != negated_;
+  }
+
+  // 若 s8 开头的码点属于集合，返回其字节长度，否则返回 0。
+  size_t match(const char* s8, size_t l) const {
+    if (!l) {
+      return 0;
+    }
+    auto b = static_cast<uint8_t>(s8[0]);
+    if (b < 0x80) {
+      return contains(b) ? 1 : 0;
+    }
+    size_t bytes;
+    char32_t cp;
+    if (!decode_codepoint(s8, l, bytes, cp)) {
+      return 0;
+    }
+    return contains(cp) ? bytes : 0;
+  }
+
+ private:
+  static void set_bits(uint64_t* bits, char32_t lo, char32_t hi) {
+    for (auto w = lo / 64; w <= hi / 64; w++) {
+      auto first = std::max<char32_t>(lo, w * 64) - w * 64;
+      auto last = std::min<char32_t>(hi, w * 64 + 63) - w * 64;
+      auto width = last - first + 1;
+      auto mask = width == 64 ? ~0ULL : ((1ULL << width) - 1) << first;
+      bits[w] |= mask;
+    }
+  }
+
+  uint64_t latin1_[4] = {};
+  uint16_t index_[256] = {};
+  std::vector<uint64_t> blocks_ = std::vector<uint64_t>(4, 0);
+  std::vector<Range> astral_;
+  bool negated_ = false;
+};
+
+/*-----------------------------------------------------------------------------
+ *  escape_characters
+ *---------------------------------------------------------------------------*/
+
+// 需要转义的字符集合。
+enum class EscapeSet {
+  Default,  // 只转义 \f \n \r \t \v
+  Json,     // 转义 " 和 \ 以及所有控制字符，结果可直接放进 JSON 字符串
+};
+
+namespace detail {
+
+inline bool is_escapable(char c, EscapeSet set) {
+  auto b = static_cast<uint8_t>(c);
+  if (set == EscapeSet::Json) {
+    return b < 0x20 || b == '"' || b == '\\';
+  }
+  return 0x09 <= b && b <= 0x0D;
+}
+
+// 返回 [i, n) 中第一个需要转义的字节的位置，没有则返回 n。
+// 每次用 SWAR 检查 8 个字节，只有可能含有需要转义的字节时才逐字节确认。
+inline size_t find_escapable(const char *s, size_t n, size_t i,
+                             EscapeSet set) {
+  constexpr uint64_t ones = 0x0101010101010101ULL;
+  constexpr uint64_t highs = 0x8080808080808080ULL;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    std::memcpy(&w, s + i, 8);
+    uint64_t hit;
+    if (set == EscapeSet::Json) {
+      auto quote = w ^ (ones * '"');
+      auto backslash = w ^ (ones * '\\');
+      hit = ((w - ones * 0x20) & ~w) | ((quote - ones) & ~quote) |
+            ((backslash - ones) & ~backslash);
+    } else {
+      // 是否有字节落在 (0x08, 0x0E) 之间，见 "Bit Twiddling Hacks" 的
+      // hasbetween。
+      auto low7 = w & (ones * 0x7F);
+      hit = (ones * (0x7F + 0x0E) - low7) & ~w &
+            (low7 + ones * (0x7F - 0x08));
+    }
+    if (hit & highs) {
+      break;
+    }
+  }
+  for (; i < n; i++) {
+    if (is_escapable(s[i], set)) {
+      return i;
+    }
+  }
+  return n;
+}
+
+// 把 c 的转义序列写入 buff，返回其长度。
+inline size_t escape_sequence(char c, EscapeSet set, char *buff) {
+  buff[0] = '\\';
+  switch (c) {
+  case '\f': buff[1] = 'f'; return 2;
+  case '\n': buff[1] = 'n'; return 2;
+  case '\r': buff[1] = 'r'; return 2;
+  case '\t': buff[1] = 't'; return 2;
+  case '\v':
+    if (set == EscapeSet::Default) {
+      buff[1] = 'v';
+      return 2;
+    }
+    break;
+  case '\b': buff[1] = 'b'; return 2;
+  case '"': buff[1] = '"'; return 2;
+  case '\\': buff[1] = '\\'; return 2;
+  default: break;
+  }
+  constexpr char hex[] = "0123456789abcdef";
+  auto b = static_cast<uint8_t>(c);
+  buff[1] = 'u';
+  buff[2] = '0';
+  buff[3] = '0';
+  buff[4] = hex[b >> 4];
+  buff[5] = hex[b & 0xF];
+  return 6;
+}
+
+} // namespace detail
+
+// 将 s 转义后追加到 out。不含需要转义的字符的片段整段复制，
+// 调用者可以反复使用同一个 out 以避免分配。
+inline void escape_characters(const char *s, size_t n, std::string &out,
+                              EscapeSet set = EscapeSet::Default) {
+  size_t i = 0;
+  while (i < n) {
+    auto j = detail::find_escapable(s, n, i, set);
+    out.append(s + i, j - i);
+    if (j == n) { break; }
+    char buff[6];
+    out.append(buff, detail::escape_sequence(s[j], set, buff));
+    i = j + 1;
+  }
+}
+
+// 将 s 转义后写入输出迭代器，返回写入结束后的迭代器。
+template <typename OutputIt>
+OutputIt escape_characters_to(const char *s, size_t n, OutputIt out,
+                              EscapeSet set = EscapeSet::Default) {
+  size_t i = 0;
+  while (i < n) {
+    auto j = detail::find_escapable(s, n, i, set);
+    out = std::copy(s + i, s + j, out);
+    if (j == n) { break; }
+    char buff[6];
+    out = std::copy(buff, buff + detail::escape_sequence(s[j], set, buff),
+                    out);
+    i = j + 1;
+  }
+  return out;
+}
+
+// 将字符串中的特殊字符转换为它们的转义序列表示。
+inline std::string escape_characters(const char *s, size_t n) {
+  std::string str;
+  str.reserve(n);
+  escape_characters(s, n, str);
+  return str;
+}
+
+inline std::string escape_characters(std::string_view sv) {
+  return escape_characters(sv.data(), sv.size());
+}
+
+/*-----------------------------------------------------------------------------
+ *  resolve_escape_sequence
+ *---------------------------------------------------------------------------*/
+
+constexpr bool is_hex(char c, int &v) {
+  if ('0' <= c && c <= '9') {
+    v = c - '0';
+    return true;
+  } else if ('a' <= c && c <= 'f') {
+    v = c - 'a' + 10;
+    return true;
+  } else if ('A' <= c && c <= 'F') {
+    v = c - 'A' + 10;
+    return true;
+  }
+  return false;
+}
+
+constexpr bool is_digit(char c, int &v) {
+  if ('0' <= c && c <= '9') {
+    v = c - '0';
+    return true;
+  }
+  return false;
+}
+
+inline std::pair<int, size_t> parse_hex_number(const char *s, size_t n,
+                                               size_t i) {
+  int ret = 0;
+  int val;
+  while (i < n && is_hex(s[i], val)) {
+    ret = static_cast<int>(ret * 16 + val);
+    i++;
+  }
+  return std::pair(ret, i);
+}
+
+inline std::pair<int, size_t> parse_octal_number(const char *s, size_t n,
+                                                 size_t i) {
+  int ret = 0;
+  int val;
+  while (i < n && is_digit(s[i], val)) {
+    ret = static_cast<int>(ret * 8 + val);
+    i++;
+  }
+  return std::pair(ret, i);
+}
+
+enum class NumberStatus {
+  Ok,
+  Invalid,   // 没有任何数字
+  Overflow,  // 数值超过允许的最大值
+};
+
+struct BoundedNumber {
+  char32_t value;
+  size_t next;  // 最后一个数字之后的位置
+  NumberStatus status;
+};
+
+namespace detail {
+
+// 用 SWAR 一次解析 sizeof(Word) 个十六进制数字（4 或 8 个），
+// 其中有非十六进制字符时返回 false。
+template <typename Word> bool parse_hex_swar(const char *s, Word &v) {
+  static_assert(sizeof(Word) == 4 || sizeof(Word) == 8);
+  constexpr Word ones = ~Word(0) / 0xFF;
+  // 按大端序组装，使第一个数字位于最高字节。
+  Word w = 0;
+  for (size_t k = 0; k < sizeof(Word); k++) {
+    w = (w << 8) | static_cast<uint8_t>(s[k]);
+  }
+  if (w & (ones * 0x80)) { return false; }
+  // 所有字节都小于 0x80，逐字节相加不会产生进位；
+  // 加上 (0x80 - lo) 后最高位为 1 表示该字节不小于 lo。
+  auto x = w | (ones * 0x20);  // 'A'-'F' 变为 'a'-'f'
+  auto digit = (w + ones * (0x80 - '0')) & ~(w + ones * (0x80 - '9' - 1));
+  auto alpha = (x + ones * (0x80 - 'a')) & ~(x + ones * (0x80 - 'f' - 1));
+  digit &= ones * 0x80;
+  alpha &= ones * 0x80;
+  if ((digit | alpha) != ones * 0x80) { return false; }
+  auto n = (x & (ones * 0x0F)) + (alpha >> 7) * 9;
+  // 相邻的半字节、字节、16 位依次两两合并。
+  n = (n | (n >> 4)) & (~Word(0) / 0xFFFF * 0x00FF);
+  n = (n | (n >> 8)) & (~Word(0) / 0xFFFFFFFF * 0xFFFF);
+  if constexpr (sizeof(Word) == 8) { n = (n | (n >> 16)) & 0xFFFFFFFF; }
+  v = n;
+  return true;
+}
+
+} // namespace detail
+
+// 从 s[i] 开始解析至多 max_digits 个十六进制数字。数值超过 max_value 时
+// 结果为 Overflow，一个数字都没有时为 Invalid。剩余输入足够时每次用
+// SWAR 解析 8 个或 4 个数字。
+inline BoundedNumber parse_hex_number(const char *s, size_t n, size_t i,
+                                      size_t max_digits, char32_t max_value) {
+  auto start = i;
+  auto end = i + std::min(max_digits, n - i);
+  uint64_t ret = 0;
+  uint64_t v8;
+  uint32_t v4;
+  if (end - i >= 8 && detail::parse_hex_swar(s + i, v8)) {
+    ret = v8;
+    i += 8;
+  } else if (end - i >= 4 && detail::parse_hex_swar(s + i, v4)) {
+    ret = v4;
+    i += 4;
+  }
+  int val;
+  while (i < end && ret <= max_value && is_hex(s[i], val)) {
+    ret = ret * 16 + val;
+    i++;
+  }
+  if (i == start) { return {0, i, NumberStatus::Invalid}; }
+  if (ret > max_value) { return {0, i, NumberStatus::Overflow}; }
+  return {static_cast<char32_t>(ret), i, NumberStatus::Ok};
+}
+
+// 从 s[i] 开始解析至多 max_digits 个八进制数字（0-7），规则同上。
+inline BoundedNumber parse_octal_number(const char *s, size_t n, size_t i,
+                                        size_t max_digits,
+                                        char32_t max_value) {
+  auto start = i;
+  auto end = i + std::min(max_digits, n - i);
+  uint64_t ret = 0;
+  while (i < end && ret <= max_value && '0' <= s[i] && s[i] <= '7') {
+    ret = ret * 8 + static_cast<uint64_t>(s[i] - '0');
+    i++;
+  }
+  if (i == start) { return {0, i, NumberStatus::Invalid}; }
+  if (ret > max_value) { return {0, i, NumberStatus::Overflow}; }
+  return {static_cast<char32_t>(ret), i, NumberStatus::Ok};
+}
+
+// 反斜杠之后的字符决定的动作。
+enum class EscapeKind : uint8_t {
+  Invalid,  // 非法的转义
+  Char,     // 输出固定的字符 value
+  Hex,      // 其后是十六进制数值
+  Unicode,  // 同 Hex，但紧跟的同类转义若构成 UTF-16 代理对则合并
+  Octal,    // 该字符本身即是八进制数值的第一位
+  Keep,     // 原样保留反斜杠和该字符
+  Skip,     // 反斜杠和该字符都不输出（续行）
+};
+
+struct EscapeAction {
+  EscapeKind kind = EscapeKind::Invalid;
+  char value = 0;
+  uint8_t min_digits = 0;
+  uint8_t max_digits = 0;
+  char32_t max_value = 0;
+  bool raw = false;  // 数值作为单个字节输出，而不是编码为 UTF-8
+};
+
+// 转义方言：以反斜杠后的字节为下标的 256 项动作表。
+struct EscapeDialect {
+  std::array<EscapeAction, 256> actions{};
+
+  constexpr void set(char c, EscapeAction action) {
+    actions[static_cast<uint8_t>(c)] = action;
+  }
+
+  constexpr void set_chars(const char *from, const char *to) {
+    for (; *from; from++, to++) {
+      set(*from, {EscapeKind::Char, *to});
+    }
+  }
+
+  constexpr void set_octal(uint8_t max_digits, char32_t max_value, bool raw) {
+    for (auto c = '0'; c <= '7'; c++) {
+      set(c, {EscapeKind::Octal, 0, 1, max_digits, max_value, raw});
+    }
+  }
+};
+
+// 本库语法中字面量和字符类使用的转义：\x 最多 2 位，\u 最多 4 位（代理对
+// 合并），\U 最多 8 位，八进制最多 3 位，结果都按码点编码为 UTF-8。
+// 其他转义（例如 \q、\a、\-、\^、\8、\9）、超过 \377 的八进制数（例如
+// \400、\777）以及后面没有数字的 \x 都是非法的。
+constexpr EscapeDialect make_peg_escape_dialect() {
+  EscapeDialect d;
+  d.set_chars("fnrtv'\"[]\\", "\f\n\r\t\v'\"[]\\");
+  d.set('x', {EscapeKind::Hex, 0, 1, 2, 0xFF});
+  d.set('u', {EscapeKind::Unicode, 0, 1, 4, 0xFFFF});
+  d.set('U', {EscapeKind::Hex, 0, 1, 8, 0x10FFFF});
+  d.set_octal(3, 0377, false);
+  return d;
+}
+
+// JSON 字符串：\u 必须正好 4 位。
+constexpr EscapeDialect make_json_escape_dialect() {
+  EscapeDialect d;
+  d.set_chars("\"\\/bfnrt", "\"\\/\b\f\n\r\t");
+  d.set('u', {EscapeKind::Unicode, 0, 4, 4, 0xFFFF});
+  return d;
+}
+
+// C 字符串字面量：\x 和八进制转义是原始字节，\u、\U 是通用字符名。
+constexpr EscapeDialect make_c_escape_dialect() {
+  EscapeDialect d;
+  d.set_chars("abfnrtv\\'\"?", "\a\b\f\n\r\t\v\\'\"?");
+  d.set('x', {EscapeKind::Hex, 0, 1, 8, 0xFF, true});
+  d.set('u', {EscapeKind::Hex, 0, 4, 4, 0xFFFF});
+  d.set('U', {EscapeKind::Hex, 0, 8, 8, 0x10FFFF});
+  d.set_octal(3, 0377, true);
+  return d;
+}
+
+// Python 的 str 字面量：未知的转义原样保留，反斜杠加换行表示续行，
+// 不支持 \N{...}。
+constexpr EscapeDialect make_python_escape_dialect() {
+  EscapeDialect d;
+  for (auto &a : d.actions) {
+    a = {EscapeKind::Keep};
+  }
+  d.set_chars("\\'\"abfnrtv", "\\'\"\a\b\f\n\r\t\v");
+  d.set('\n', {EscapeKind::Skip});
+  d.set('x', {EscapeKind::Hex, 0, 2, 2, 0xFF});
+  d.set('u', {EscapeKind::Hex, 0, 4, 4, 0xFFFF});
+  d.set('U', {EscapeKind::Hex, 0, 8, 8, 0x10FFFF});
+  d.set('N', {EscapeKind::Invalid});
+  d.set_octal(3, 0777, false);
+  return d;
+}
+
+inline constexpr EscapeDialect PegEscapes = make_peg_escape_dialect();
+inline constexpr EscapeDialect JsonEscapes = make_json_escape_dialect();
+inline constexpr EscapeDialect CEscapes = make_c_escape_dialect();
+inline constexpr EscapeDialect PythonEscapes = make_python_escape_dialect();
+
+// 按 dialect 解析包含转义序列的字符串，并将这些序列转换回它们对应的字符。
+// 非法的转义（包括位数不足、数值超出范围、孤立的代理）抛出
+// std::runtime_error，因此一次扫描同时完成反转义和校验。
+inline std::string
+resolve_escape_sequence(const char *s, size_t n,
+                        const EscapeDialect &dialect = PegEscapes) {
+  std::string r;
+  r.reserve(n);
+
+  auto invalid = [] { throw std::runtime_error("Invalid escape sequence..."); };
+  auto append = [&](const BoundedNumber &num, size_t digits,
+                    const EscapeAction &a) {
+    if (num.status != NumberStatus::Ok || digits < a.min_digits) {
+      invalid();
+    }
+    if (a.raw) {
+      r += static_cast<char>(num.value);
+      return;
+    }
+    char buff[4];
+    auto l = encode_codepoint(num.value, buff);
+    if (!l) { invalid(); }
+    r.append(buff, l);
+  };
+
+  size_t i = 0;
+  while (i < n) {
+    if (s[i] != '\\') {
+      // 一次复制到下一个反斜杠为止的整段。
+      auto p = static_cast<const char *>(std::memchr(s + i, '\\', n - i));
+      auto j = p ? static_cast<size_t>(p - s) : n;
+      r.append(s + i, j - i);
+      i = j;
+      continue;
+    }
+    i++;
+    if (i == n) { invalid(); }
+    auto c = s[i];
+    const auto &a = dialect.actions[static_cast<uint8_t>(c)];
+    switch (a.kind) {
+    case EscapeKind::Char:
+      r += a.value;
+      i++;
+      break;
+    case EscapeKind::Hex: {
+      auto num = parse_hex_number(s, n, i + 1, a.max_digits, a.max_value);
+      append(num, num.next - i - 1, a);
+      i = num.next;
+      break;
+    }
+    case EscapeKind::Unicode: {
+      auto num = parse_hex_number(s, n, i + 1, a.max_digits, a.max_value);
+      auto digits = num.next - i - 1;
+      i = num.next;
+      if (num.status == NumberStatus::Ok && 0xD800 <= num.value &&
+          num.value <= 0xDBFF && i + 1 < n && s[i] == '\\' && s[i + 1] == c) {
+        auto low = parse_hex_number(s, n, i + 2, a.max_digits, a.max_value);
+        auto low_digits = low.next - i - 2;
+        if (low.status == NumberStatus::Ok && low_digits >= a.min_digits &&
+            0xDC00 <= low.value && low.value <= 0xDFFF) {
+          num.value =
+              0x10000 + ((num.value - 0xD800) << 10) + (low.value - 0xDC00);
+          i = low.next;
+        }
+      }
+      append(num, digits, a);
+      break;
+    }
+    case EscapeKind::Octal: {
+      auto num = parse_octal_number(s, n, i, a.max_digits, a.max_value);
+      append(num, num.next - i, a);
+      i = num.next;
+      break;
+    }
+    case EscapeKind::Keep:
+      r += '\\';
+      r += c;
+      i++;
+      break;
+    case EscapeKind::Skip: i++; break;
+    default: invalid(); break;
+    }
+  }
+  return r;
+}
+
+// 借用外部字符串或持有自己的字符串的结果类型。借用时调用者需保证
+// 被借用的字符串在结果使用期间有效。
+class CowString {
+public:
+  CowString() = default;
+  explicit CowString(std::string_view borrowed)
+      : data_(borrowed.data()), size_(borrowed.size()) {}
+  explicit CowString(std::string owned)
+      : owned_(std::move(owned)), is_owned_(true) {}
+  // 字符串字面量等以 '\0' 结尾的字符串按借用处理，否则会在上面两个构造
+  // 函数之间产生歧义。
+  explicit CowString(const char *borrowed)
+      : CowString(std::string_view(borrowed)) {}
+
+  std::string_view view() const {
+    return is_owned_ ? std::string_view(owned_)
+                     : std::string_view(data_, size_);
+  }
+  operator std::string_view() const { return view(); }
+
+  const char *data() const { return view().data(); }
+  size_t size() const { return view().size(); }
+  bool empty() const { return view().empty(); }
+
+  // 是否持有自己的字符串（即发生过一次分配）。
+  bool owned() const { return is_owned_; }
+
+  std::string str() const & { return std::string(view()); }
+  std::string str() && {
+    return is_owned_ ? std::move(owned_) : std::string(view());
+  }
+
+private:
+  const char *data_ = "";
+  size_t size_ = 0;
+  std::string owned_;
+  bool is_owned_ = false;
+};
+
+// 与 resolve_escape_sequence 相同，但输入中没有反斜杠时（用 memchr 扫描，
+// 通常是向量化的）直接借用输入，不分配也不复制。
+inline CowString
+resolve_escape_sequence_view(const char *s, size_t n,
+                             const EscapeDialect &dialect = PegEscapes) {
+  if (!std::memchr(s, '\\', n)) { return CowString(std::string_view(s, n)); }
+  return CowString(resolve_escape_sequence(s, n, dialect));
+}
+
+/*-----------------------------------------------------------------------------
+ *  Number
+ *---------------------------------------------------------------------------*/
+
+// 数值解析的结果。ec 的约定与 std::from_chars 相同：成功为 std::errc{}，
+// 没有可解析的内容为 invalid_argument，超出范围为 result_out_of_range。
+// consumed 是被解析的字符数。
+template <typename T> struct NumberResult {
+  T value;
+  std::errc ec;
+  size_t consumed;
+};
+
+namespace detail {
+
+template <typename T> struct FloatTraits;
+
+template <> struct FloatTraits<double> {
+  using Bits = uint64_t;
+  static constexpr int MantissaBits = 52;
+  static constexpr int ExponentBits = 11;
+  static constexpr int Bias = -1023;
+  // 能精确表示的最大的 10 的幂，以及能精确表示其所有整数的最大的 10 的幂。
+  static constexpr int MaxExactPow10 = 22;
+  static constexpr int MaxExactIntPow10 = 15;
+  static constexpr double Pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                     1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                     1e18, 1e19, 1e20, 1e21, 1e22};
+};
+
+template <> struct FloatTraits<float> {
+  using Bits = uint32_t;
+  static constexpr int MantissaBits = 23;
+  static constexpr int ExponentBits = 8;
+  static constexpr int Bias = -127;
+  static constexpr int MaxExactPow10 = 10;
+  static constexpr int MaxExactIntPow10 = 7;
+  static constexpr float Pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                    1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+};
+
+// 返回 a * b 的高 64 位，低 64 位写入 lo。
+inline uint64_t mul_64x64(uint64_t a, uint64_t b, uint64_t &lo) {
+#ifdef __SIZEOF_INT128__
+  __extension__ using Uint128 = unsigned __int128;
+  auto r = static_cast<Uint128>(a) * b;
+  lo = static_cast<uint64_t>(r);
+  return static_cast<uint64_t>(r >> 64);
+#else
+  auto a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+  auto b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+  auto ll = a_lo * b_lo, lh = a_lo * b_hi, hl = a_hi * b_lo, hh = a_hi * b_hi;
+  auto mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+  lo = (mid << 32) | (ll & 0xFFFFFFFF);
+  return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+// x 不能为 0。
+inline int count_leading_zeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  for (; !(x >> 63); x <<= 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+constexpr int Pow10TableMin = -348;
+constexpr int Pow10TableMax = 347;
+
+using Pow10Table =
+    std::array<std::array<uint64_t, 2>, Pow10TableMax - Pow10TableMin + 1>;
+
+// 以 32 位为一段、低位在前保存的 1280 位无符号大整数，只用于在首次使用时
+// 生成 5 的幂的表（pow10_table 和 pow5_tables）。
+class BigInt {
+public:
+  static constexpr int Bits = 40 * 32;
+
+  // 2^e。
+  explicit BigInt(int e) { words_[e / 32] = uint32_t(1) << (e % 32); }
+
+  void mul5() {
+    uint64_t carry = 0;
+    for (auto &w : words_) {
+      auto v = uint64_t(w) * 5 + carry;
+      w = static_cast<uint32_t>(v);
+      carry = v >> 32;
+    }
+  }
+
+  // 除以 5，向下取整。
+  void div5() {
+    uint64_t rem = 0;
+    for (auto k = std::size(words_); k-- > 0;) {
+      auto v = (rem << 32) | words_[k];
+      words_[k] = static_cast<uint32_t>(v / 5);
+      rem = v % 5;
+    }
+  }
+
+  // 第 b 位，超出范围时为 0。
+  uint64_t bit(int b) const {
+    return b >= 0 && b < Bits && ((words_[b / 32] >> (b % 32)) & 1);
+  }
+
+  // 最高的为 1 的位，值不能为 0。
+  int msb() const {
+    auto b = Bits - 1;
+    while (!bit(b)) {
+      b--;
+    }
+    return b;
+  }
+
+private:
+  uint32_t words_[Bits / 32] = {};
+};
+
+// 10^e（Pow10TableMin <= e <= Pow10TableMax）的 128 位规范化尾数（最高位
+// 为 1，向下截断），以 {高 64 位, 低 64 位} 保存。首次使用时用大整数生成：
+// e >= 0 时取 5^e 的最高 128 位，e < 0 时取 2^1279 / 5^-e 的最高 128 位，
+// 因为 10^e 与 5^e 只差一个 2 的幂。
+inline const Pow10Table &pow10_table() {
+  static const auto table = []() {
+    Pow10Table t{};
+    auto top_bits = [](const BigInt &big) {
+      auto msb = big.msb();
+      std::array<uint64_t, 2> r{};
+      for (int k = 0; k < 128; k++) {
+        r[k / 64] |= big.bit(msb - k) << (63 - k % 64);
+      }
+      return r;
+    };
+    BigInt big(0);
+    for (auto e = 0; e <= Pow10TableMax; e++) {
+      t[e - Pow10TableMin] = top_bits(big);
+      big.mul5();
+    }
+    big = BigInt(BigInt::Bits - 1);
+    for (auto e = -1; e >= Pow10TableMin; e--) {
+      big.div5();
+      t[e - Pow10TableMin] = top_bits(big);
+    }
+    return t;
+  }();
+  return table;
+}
+
+// Clinger 快速路径：mantissa 和 10^|exp10| 都能精确表示时，一次乘法或
+// 除法即可得到正确舍入的结果。
+template <typename T>
+bool clinger_fast_path(uint64_t mantissa, int exp10, bool negative, T &value) {
+  using Traits = FloatTraits<T>;
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+  return false;  // 中间结果精度更高时（如 x87）会发生两次舍入
+#endif
+  if (mantissa >> Traits::MantissaBits) { return false; }
+  auto f = static_cast<T>(mantissa);
+  if (exp10 > 0 && exp10 <= Traits::MaxExactPow10 + Traits::MaxExactIntPow10) {
+    // 指数较大但数字较少时，先把多出的 0 乘进整数部分。
+    if (exp10 > Traits::MaxExactPow10) {
+      f *= Traits::Pow10[exp10 - Traits::MaxExactPow10];
+      exp10 = Traits::MaxExactPow10;
+    }
+    if (f > Traits::Pow10[Traits::MaxExactIntPow10]) { return false; }
+    f *= Traits::Pow10[exp10];
+  } else if (exp10 < 0 && exp10 >= -Traits::MaxExactPow10) {
+    f /= Traits::Pow10[-exp10];
+  } else if (exp10 != 0) {
+    return false;
+  }
+  value = negative ? -f : f;
+  return true;
+}
+
+// Eisel-Lemire 算法：用 10^exp10 的 128 位近似计算 mantissa * 10^exp10。
+// 无法确定正确舍入的结果（包括次正规数和溢出）时返回 false。
+// 见 Daniel Lemire, "Number Parsing at a Gigabyte per Second"。
+template <typename T>
+bool eisel_lemire(uint64_t mantissa, int exp10, bool negative, T &value) {
+  using Traits = FloatTraits<T>;
+  using Bits = typename Traits::Bits;
+  constexpr int mantissa_bits = Traits::MantissaBits;
+  constexpr int shift = 64 - mantissa_bits - 3;
+  constexpr uint64_t mask = (uint64_t(1) << shift) - 1;
+  constexpr uint64_t max_exp2 = (uint64_t(1) << Traits::ExponentBits) - 1;
+
+  if (!mantissa) {
+    value = negative ? -T(0) : T(0);
+    return true;
+  }
+  if (exp10 < Pow10TableMin || exp10 > Pow10TableMax) { return false; }
+
+  auto clz = count_leading_zeros(mantissa);
+  mantissa <<= clz;
+  // (217706 * exp10) >> 16 即 floor(exp10 * log2(10))。
+  auto exp2 = static_cast<uint64_t>(((217706 * exp10) >> 16) + 64 -
+                                    Traits::Bias) -
+              static_cast<uint64_t>(clz);
+
+  const auto &pow10 = pow10_table()[exp10 - Pow10TableMin];
+  uint64_t lo;
+  auto hi = mul_64x64(mantissa, pow10[0], lo);
+  // 高位的低 shift 位全为 1 时，截断的误差可能影响结果，用低 64 位修正。
+  if ((hi & mask) == mask && lo + mantissa < mantissa) {
+    uint64_t y_lo;
+    auto y_hi = mul_64x64(mantissa, pow10[1], y_lo);
+    auto merged_hi = hi;
+    auto merged_lo = lo + y_hi;
+    if (merged_lo < lo) { merged_hi++; }
+    if ((merged_hi & mask) == mask && merged_lo + 1 == 0 &&
+        y_lo + mantissa < mantissa) {
+      return false;
+    }
+    hi = merged_hi;
+    lo = merged_lo;
+  }
+
+  auto msb = hi >> 63;
+  auto m = hi >> (msb + shift);
+  exp2 -= 1 ^ msb;
+  // 恰好位于两个可表示值的中间时，近似值不足以决定舍入方向。
+  if (lo == 0 && (hi & mask) == 0 && (m & 3) == 1) { return false; }
+
+  m += m & 1;
+  m >>= 1;
+  if (m >> (mantissa_bits + 1)) {
+    m >>= 1;
+    exp2++;
+  }
+  if (exp2 - 1 >= max_exp2 - 1) { return false; }
+
+  auto bits = static_cast<Bits>((exp2 << mantissa_bits) |
+                                (m & ((uint64_t(1) << mantissa_bits) - 1)));
+  if (negative) { bits |= Bits(1) << (mantissa_bits + Traits::ExponentBits); }
+  std::memcpy(&value, &bits, sizeof(T));
+  return true;
+}
+
+// 任意精度的十进制数 0.d[0]d[1]...d[nd-1] * 10^dp，用于快速路径无法确定
+// 结果时的精确转换（算法同 Go 的 strconv）。最多保存 MaxDigits 位，之后的
+// 非零数字只记录在 trunc_ 中，这足以正确舍入任何 double。
+class Decimal {
+public:
+  static constexpr int MaxDigits = 800;
+
+  // 由数字串 s（可以含一个小数点）设置各位数字，小数点位置为 dp。
+  void assign(const char *s, size_t n, int dp) {
+    nd_ = 0;
+    dp_ = dp;
+    trunc_ = false;
+    for (size_t i = 0; i < n; i++) {
+      if (s[i] == '.' || (s[i] == '0' && nd_ == 0)) { continue; }
+      if (nd_ < MaxDigits) {
+        d_[nd_++] = static_cast<uint8_t>(s[i] - '0');
+      } else if (s[i] != '0') {
+        trunc_ = true;
+      }
+    }
+    trim();
+  }
+
+  // 乘以 2^k，k 可以为负。
+  void shift(int k) {
+    if (!nd_) { return; }
+    for (; k > MaxShift; k -= MaxShift) {
+      left_shift(MaxShift);
+    }
+    for (; k < -MaxShift; k += MaxShift) {
+      right_shift(MaxShift);
+    }
+    if (k > 0) {
+      left_shift(k);
+    } else if (k < 0) {
+      right_shift(-k);
+    }
+  }
+
+  // 四舍五入（恰好一半时取偶数）到整数。
+  uint64_t rounded_integer() const {
+    if (dp_ > 20) { return ~uint64_t(0); }
+    uint64_t n = 0;
+    int i = 0;
+    for (; i < dp_ && i < nd_; i++) {
+      n = n * 10 + d_[i];
+    }
+    for (; i < dp_; i++) {
+      n *= 10;
+    }
+    if (should_round_up(dp_)) { n++; }
+    return n;
+  }
+
+  // 转换为最接近的 T 的位模式（不含符号位）。溢出时 overflow 为 true，
+  // 结果为无穷大。
+  template <typename T> uint64_t float_bits(bool &overflow) {
+    using Traits = FloatTraits<T>;
+    constexpr int mantissa_bits = Traits::MantissaBits;
+    constexpr int max_exp = (1 << Traits::ExponentBits) - 1;
+    constexpr int bias = Traits::Bias;
+    // 小数点左移 dp 位所需的二进制位数。
+    constexpr int powtab[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+    auto pow2 = [&](int dp) { return dp < 9 ? powtab[dp] : 27; };
+
+    overflow = false;
+    if (!nd_ || dp_ < -330) { return 0; }
+    if (dp_ > 310) {
+      overflow = true;
+      return uint64_t(max_exp) << mantissa_bits;
+    }
+
+    // 缩放到 [0.5, 1)。
+    auto exp = 0;
+    while (dp_ > 0) {
+      auto n = pow2(dp_);
+      shift(-n);
+      exp += n;
+    }
+    while (dp_ < 0 || (dp_ == 0 && d_[0] < 5)) {
+      auto n = pow2(-dp_);
+      shift(n);
+      exp -= n;
+    }
+    // 浮点数的尾数在 [1, 2) 中；指数过小时是次正规数。
+    exp--;
+    if (exp < bias + 1) {
+      auto n = bias + 1 - exp;
+      shift(-n);
+      exp += n;
+    }
+    if (exp - bias >= max_exp) {
+      overflow = true;
+      return uint64_t(max_exp) << mantissa_bits;
+    }
+
+    shift(1 + mantissa_bits);
+    auto mant = rounded_integer();
+    // 舍入可能进位到更高一位。
+    if (mant == uint64_t(2) << mantissa_bits) {
+      mant >>= 1;
+      exp++;
+      if (exp - bias >= max_exp) {
+        overflow = true;
+        return uint64_t(max_exp) << mantissa_bits;
+      }
+    }
+    if (!(mant & (uint64_t(1) << mantissa_bits))) { exp = bias; }
+    return (mant & ((uint64_t(1) << mantissa_bits) - 1)) |
+           (uint64_t(exp - bias) << mantissa_bits);
+  }
+
+private:
+  // 每次最多移动 60 位，使 uint64_t 的中间结果不会溢出；2^60 < 10^19，
+  // 左移一次最多增加 19 位数字。
+  static constexpr int MaxShift = 60;
+  static constexpr int ShiftSlack = 19;
+
+  void left_shift(int k) {
+    // 从最低位开始，把结果写到 d_[nd_ + ShiftSlack) 之前，写入位置总在
+    // 读取位置之后，再整体移到开头。
+    auto r = nd_;
+    auto w = nd_ + ShiftSlack;
+    uint64_t n = 0;
+    while (r > 0) {
+      n += uint64_t(d_[--r]) << k;
+      auto q = n / 10;
+      d_[--w] = static_cast<uint8_t>(n - q * 10);
+      n = q;
+    }
+    while (n > 0) {
+      auto q = n / 10;
+      d_[--w] = static_cast<uint8_t>(n - q * 10);
+      n = q;
+    }
+    auto len = nd_ + ShiftSlack - w;
+    std::memmove(d_, d_ + w, static_cast<size_t>(len));
+    dp_ += len - nd_;
+    nd_ = len;
+    if (nd_ > MaxDigits) {
+      for (auto i = MaxDigits; i < nd_; i++) {
+        if (d_[i]) { trunc_ = true; }
+      }
+      nd_ = MaxDigits;
+    }
+    trim();
+  }
+
+  void right_shift(int k) {
+    auto r = 0;
+    auto w = 0;
+    uint64_t n = 0;
+    // 读入足够的高位，使 n >> k 不为 0。
+    for (; !(n >> k); r++) {
+      if (r >= nd_) {
+        if (!n) {
+          nd_ = 0;
+          return;
+        }
+        for (; !(n >> k); r++) {
+          n *= 10;
+        }
+        break;
+      }
+      n = n * 10 + d_[r];
+    }
+    dp_ -= r - 1;
+    auto mask = (uint64_t(1) << k) - 1;
+    for (; r < nd_; r++) {
+      d_[w++] = static_cast<uint8_t>(n >> k);
+      n = (n & mask) * 10 + d_[r];
+    }
+    while (n > 0) {
+      auto dig = n >> k;
+      n &= mask;
+      if (w < MaxDigits) {
+        d_[w++] = static_cast<uint8_t>(dig);
+      } else if (dig > 0) {
+        trunc_ = true;
+      }
+      n *= 10;
+    }
+    nd_ = w;
+    trim();
+  }
+
+  bool should_round_up(int nd) const {
+    if (nd < 0 || nd >= nd_) { return false; }
+    // 恰好一半时取偶数；若有被截断的非零数字，实际值略大于一半。
+    if (d_[nd] == 5 && nd + 1 == nd_) {
+      return trunc_ || (nd > 0 && d_[nd - 1] % 2 == 1);
+    }
+    return d_[nd] >= 5;
+  }
+
+  void trim() {
+    while (nd_ > 0 && !d_[nd_ - 1]) {
+      nd_--;
+    }
+    if (!nd_) { dp_ = 0; }
+  }
+
+  uint8_t d_[MaxDigits + ShiftSlack];
+  int nd_ = 0;
+  int dp_ = 0;
+  bool trunc_ = false;
+};
+
+} // namespace detail
+
+// 把十进制浮点数转换为 float 或 double，结果与 strtod 一样正确舍入，但不
+// 依赖 locale，也不分配内存。接受可选的正负号、数字和小数点、e 或 E 开头
+// 的指数，以及不区分大小写的 inf、infinity 和 nan；不跳过前导空白。
+// 溢出时结果为无穷大，非零的值下溢为 0 时 ec 为 result_out_of_range。
+//
+// 先尝试 Clinger 快速路径，再尝试 Eisel-Lemire，都无法确定时才用
+// detail::Decimal 精确计算。
+template <typename T> NumberResult<T> parse_float(std::string_view sv) {
+  static_assert(std::is_same<T, float>::value ||
+                std::is_same<T, double>::value);
+  auto s = sv.data();
+  auto n = sv.size();
+  size_t i = 0;
+
+  auto negative = false;
+  if (i < n && (s[i] == '+' || s[i] == '-')) {
+    negative = s[i] == '-';
+    i++;
+  }
+
+  auto word = [&](const char *w, size_t len) {
+    if (n - i < len) { return false; }
+    for (size_t k = 0; k < len; k++) {
+      if ((s[i + k] | 0x20) != w[k]) { return false; }
+    }
+    return true;
+  };
+  if (word("inf", 3)) {
+    i += word("infinity", 8) ? 8 : 3;
+    auto v = std::numeric_limits<T>::infinity();
+    return {negative ? -v : v, std::errc{}, i};
+  }
+  if (word("nan", 3)) {
+    auto v = std::numeric_limits<T>::quiet_NaN();
+    return {negative ? -v : v, std::errc{}, i + 3};
+  }
+
+  // 最多读取 19 位有效数字到 mantissa，其余的非零数字记录在 trunc 中。
+  // dp 是小数点相对于第一个有效数字的位置。
+  constexpr int max_mantissa_digits = 19;
+  auto digits_begin = i;
+  uint64_t mantissa = 0;
+  auto nd = 0;
+  auto nd_mantissa = 0;
+  auto dp = 0;
+  auto saw_dot = false;
+  auto saw_digits = false;
+  auto trunc = false;
+  for (; i < n; i++) {
+    auto c = s[i];
+    if (c == '.') {
+      if (saw_dot) { break; }
+      saw_dot = true;
+      dp = nd;
+      continue;
+    }
+    if (c < '0' || '9' < c) { break; }
+    saw_digits = true;
+    if (c == '0' && nd == 0) {
+      dp--;
+      continue;
+    }
+    nd++;
+    if (nd_mantissa < max_mantissa_digits) {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(c - '0');
+      nd_mantissa++;
+    } else if (c != '0') {
+      trunc = true;
+    }
+  }
+  if (!saw_digits) { return {T(0), std::errc::invalid_argument, 0}; }
+  auto digits_end = i;
+  if (!saw_dot) { dp = nd; }
+
+  // 指数部分不完整时（如 "1e+"）不属于这个数。
+  if (i < n && (s[i] | 0x20) == 'e') {
+    auto j = i + 1;
+    auto exp_negative = false;
+    if (j < n && (s[j] == '+' || s[j] == '-')) {
+      exp_negative = s[j] == '-';
+      j++;
+    }
+    if (j < n && '0' <= s[j] && s[j] <= '9') {
+      auto e = 0;
+      for (; j < n && '0' <= s[j] && s[j] <= '9'; j++) {
+        if (e < 10000) { e = e * 10 + (s[j] - '0'); }
+      }
+      dp += exp_negative ? -e : e;
+      i = j;
+    }
+  }
+
+  auto exp10 = mantissa ? dp - nd_mantissa : 0;
+  T value;
+  if (!trunc && detail::clinger_fast_path(mantissa, exp10, negative, value)) {
+    return {value, std::errc{}, i};
+  }
+  if (detail::eisel_lemire(mantissa, exp10, negative, value)) {
+    // 有效数字被截断时，真实值在 mantissa 和 mantissa + 1 之间，
+    // 两端的结果相同才能确定。
+    T upper;
+    if (!trunc ||
+        (detail::eisel_lemire(mantissa + 1, exp10, negative, upper) &&
+         upper == value)) {
+      return {value, std::errc{}, i};
+    }
+  }
+
+  using Bits = typename detail::FloatTraits<T>::Bits;
+  detail::Decimal d;
+  d.assign(s + digits_begin, digits_end - digits_begin, dp);
+  auto overflow = false;
+  auto bits = static_cast<Bits>(d.template float_bits<T>(overflow));
+  std::memcpy(&value, &bits, sizeof(T));
+  if (negative) { value = -value; }
+  auto ec = overflow || (!bits && mantissa) ? std::errc::result_out_of_range
+                                            : std::errc{};
+  return {value, ec, i};
+}
+
+namespace detail {
+
+// 若 c 是 base 进制（不超过 36）的数字，把它的值写入 d。
+inline bool digit_value(char c, int base, int &d) {
+  auto lower = c | 0x20;
+  if ('0' <= c && c <= '9') {
+    d = c - '0';
+  } else if ('a' <= lower && lower <= 'z') {
+    d = lower - 'a' + 10;
+  } else {
+    return false;
+  }
+  return d < base;
+}
+
+// 以小端序读取 8 个字节，第一个字符在最低字节。
+inline uint64_t load_le64(const char *s) {
+  uint64_t w = 0;
+  for (size_t k = 0; k < 8; k++) {
+    w |= uint64_t(static_cast<uint8_t>(s[k])) << (8 * k);
+  }
+  return w;
+}
+
+// w 的 8 个字节是否都是 '0'-'9'。
+inline bool is_eight_digits(uint64_t w) {
+  return ((w & 0xF0F0F0F0F0F0F0F0) |
+          (((w + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+         0x3333333333333333;
+}
+
+// 用 SWAR 把 8 个十进制数字转换为数值：相邻的数字、两位数、四位数依次
+// 两两合并。
+inline uint64_t parse_eight_digits(uint64_t w) {
+  w -= 0x3030303030303030;
+  w = (w * 10) + (w >> 8);
+  return (((w & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+          (((w >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+         32;
+}
+
+// 从 s[i] 开始解析 base 进制的数字串，s[i] 必须是数字。两个数字之间可以
+// 有一个 separator（为 0 时不允许）。i 移到数字串之后；数值超过 uint64_t
+// 时 overflow 为 true。十进制每次尽量用 SWAR 解析 8 个数字。
+inline uint64_t parse_digits(const char *s, size_t n, size_t &i, int base,
+                             char separator, bool &overflow) {
+  constexpr auto max = std::numeric_limits<uint64_t>::max();
+  constexpr uint64_t chunk_limit = (max - 99999999) / 100000000;
+  auto limit = max / static_cast<uint64_t>(base);
+  auto last = max % static_cast<uint64_t>(base);
+  uint64_t v = 0;
+  overflow = false;
+  int d;
+  for (;;) {
+    if (base == 10) {
+      for (; n - i >= 8; i += 8) {
+        auto w = load_le64(s + i);
+        if (!is_eight_digits(w)) { break; }
+        auto chunk = parse_eight_digits(w);
+        if (v > chunk_limit && v > (max - chunk) / 100000000) {
+          overflow = true;
+        } else {
+          v = v * 100000000 + chunk;
+        }
+      }
+    }
+    if (i < n && digit_value(s[i], base, d)) {
+      auto ud = static_cast<uint64_t>(d);
+      if (v > limit || (v == limit && ud > last)) {
+        overflow = true;
+      } else {
+        v = v * static_cast<uint64_t>(base) + ud;
+      }
+      i++;
+    } else if (separator && i + 1 < n && s[i] == separator &&
+               digit_value(s[i + 1], base, d)) {
+      i++;
+    } else {
+      break;
+    }
+  }
+  return v;
+}
+
+// 把绝对值 v 和符号转换为 T，超出范围时返回 result_out_of_range。
+template <typename T>
+NumberResult<T> to_integer(uint64_t v, bool negative, bool overflow,
+                           size_t consumed) {
+  using U = typename std::make_unsigned<T>::type;
+  uint64_t max = static_cast<U>(std::numeric_limits<T>::max());
+  if (negative) { max++; }
+  if (overflow || v > max) {
+    return {T(0), std::errc::result_out_of_range, consumed};
+  }
+  auto u = static_cast<U>(v);
+  if (negative) { u = static_cast<U>(U(0) - u); }
+  return {static_cast<T>(u), std::errc{}, consumed};
+}
+
+} // namespace detail
+
+// 把数字转换为整数或浮点数，不分配内存。整数可以有正负号（无符号类型不
+// 接受负号）和 0x、0o、0b 前缀（不区分大小写，其后必须是相应进制的数字，
+// 否则只解析 "0"），相邻数字之间可以有一个 separator，例如 "0xFF_FF"、
+// "1_000_000"；separator 为 0 时不允许分隔符。超出 T 的范围时 ec 为
+// result_out_of_range，value 为 0，consumed 包括整个数字串。浮点数由
+// parse_float 解析，不支持分隔符。
+template <typename T>
+NumberResult<T> parse_number(std::string_view sv, char separator = '_') {
+  if constexpr (std::is_floating_point<T>::value) {
+    (void)separator;
+    return parse_float<T>(sv);
+  } else {
+    static_assert(std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                  sizeof(T) <= sizeof(uint64_t));
+    auto s = sv.data();
+    auto n = sv.size();
+    size_t i = 0;
+
+    auto negative = false;
+    if (i < n && (s[i] == '+' || s[i] == '-')) {
+      negative = s[i] == '-';
+      if (negative && std::is_unsigned<T>::value) {
+        return {T(0), std::errc::invalid_argument, 0};
+      }
+      i++;
+    }
+
+    auto base = 10;
+    int d;
+    if (n - i >= 3 && s[i] == '0') {
+      auto p = s[i + 1] | 0x20;
+      auto b = p == 'x' ? 16 : p == 'o' ? 8 : p == 'b' ? 2 : 0;
+      if (b && detail::digit_value(s[i + 2], b, d)) {
+        base = b;
+        i += 2;
+      }
+    }
+    if (i == n || !detail::digit_value(s[i], base, d)) {
+      return {T(0), std::errc::invalid_argument, 0};
+    }
+
+    auto overflow = false;
+    auto v = detail::parse_digits(s, n, i, base, separator, overflow);
+    return detail::to_integer<T>(v, negative, overflow, i);
+  }
+}
+
+namespace detail {
+
+// 以小端序读取 s 的前 len（不超过 8）个字节，不越界读取，高位补 0。
+inline uint64_t load_partial_le64(const char *s, size_t len) {
+  auto load_le32 = [](const char *p) {
+    uint32_t w = 0;
+    for (size_t k = 0; k < 4; k++) {
+      w |= uint32_t(static_cast<uint8_t>(p[k])) << (8 * k);
+    }
+    return w;
+  };
+  if (len >= 4) {
+    // 两次可能重叠的 4 字节读取。
+    return load_le32(s) | (uint64_t(load_le32(s + len - 4)) << (8 * (len - 4)));
+  }
+  uint64_t w = 0;
+  for (size_t k = 0; k < len; k++) {
+    w |= uint64_t(static_cast<uint8_t>(s[k])) << (8 * k);
+  }
+  return w;
+}
+
+// 把 len（1 到 8）个数字右对齐到 8 个数字，左边补 '0'。
+inline uint64_t pad_digits(uint64_t w, size_t len) {
+  if (len == 8) { return w; }
+  return (w << (8 * (8 - len))) | (0x3030303030303030 >> (8 * len));
+}
+
+// 解析长度为 1 到 16 的十进制数字串，含有非数字时返回 false。数字串被
+// 补齐为两个 8 字节的字后一次验证并转换。
+inline bool parse_decimal16_scalar(const char *s, size_t len, uint64_t &v) {
+  if (len <= 8) {
+    auto w = pad_digits(load_partial_le64(s, len), len);
+    if (!is_eight_digits(w)) { return false; }
+    v = parse_eight_digits(w);
+    return true;
+  }
+  auto hi = pad_digits(load_partial_le64(s, len - 8), len - 8);
+  auto lo = load_le64(s + len - 8);
+  if (!is_eight_digits(hi) || !is_eight_digits(lo)) { return false; }
+  v = parse_eight_digits(hi) * 100000000 + parse_eight_digits(lo);
+  return true;
+}
+
+#ifdef PEG_USE_X86_SIMD
+PEG_TARGET("ssse3")
+inline bool parse_decimal16_ssse3(const char *s, size_t len, uint64_t &v) {
+  // 只有一个字时 SWAR 更快。
+  if (len <= 8) { return parse_decimal16_scalar(s, len, v); }
+  auto hi = pad_digits(load_partial_le64(s, len - 8), len - 8);
+  auto lo = load_le64(s + len - 8);
+  auto d = _mm_sub_epi8(_mm_set_epi64x(static_cast<long long>(lo),
+                                       static_cast<long long>(hi)),
+                        _mm_set1_epi8('0'));
+  const auto nine = _mm_set1_epi8(9);
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine)) !=
+      0xFFFF) {
+    return false;
+  }
+  // 相邻的数字、两位数、四位数依次两两合并，得到前后两个八位数。
+  auto t = _mm_maddubs_epi16(
+      d, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+  t = _mm_madd_epi16(t, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+  t = _mm_packs_epi32(t, t);
+  t = _mm_madd_epi16(t,
+                     _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+  auto h = static_cast<uint32_t>(_mm_cvtsi128_si32(t));
+  auto l = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(t, 4)));
+  v = uint64_t(h) * 100000000 + l;
+  return true;
+}
+#endif
+
+using Decimal16Kernel = bool (*)(const char *, size_t, uint64_t &);
+
+// 批量解析中的单个 token：最常见的不超过 16 位、没有前缀和分隔符的十进制
+// 整数走 Decimal16，其余交给 parse_number。
+template <typename T, Decimal16Kernel Decimal16>
+NumberResult<T> parse_number_token(std::string_view sv) {
+  if constexpr (std::is_integral<T>::value) {
+    auto s = sv.data();
+    auto n = sv.size();
+    size_t i = n && (s[0] == '+' || s[0] == '-') ? 1 : 0;
+    auto negative = i && s[0] == '-';
+    uint64_t v;
+    if (n > i && n - i <= 16 && !(negative && std::is_unsigned<T>::value) &&
+        Decimal16(s + i, n - i, v)) {
+      return to_integer<T>(v, negative, false, n);
+    }
+  }
+  return parse_number<T>(sv);
+}
+
+template <typename T, Decimal16Kernel Decimal16, typename Token>
+size_t parse_numbers_range(const Token &token, size_t begin, size_t end,
+                           T *out, std::errc *errors) {
+  size_t failures = 0;
+  for (auto k = begin; k < end; k++) {
+    auto sv = token(k);
+    auto r = parse_number_token<T, Decimal16>(sv);
+    auto ec = r.ec == std::errc{} && r.consumed != sv.size()
+                  ? std::errc::invalid_argument
+                  : r.ec;
+    out[k] = ec == std::errc{} ? r.value : T(0);
+    if (errors) { errors[k] = ec; }
+    if (ec != std::errc{}) { failures++; }
+  }
+  return failures;
+}
+
+// 每段只选择一次 kernel，之后对每个 token 直接调用，不经过函数指针。
+template <typename T, typename Token>
+size_t parse_numbers_chunk(const Token &token, size_t begin, size_t end,
+                           T *out, std::errc *errors) {
+#ifdef PEG_USE_X86_SIMD
+  if (simd_level() >= SimdLevel::SSSE3) {
+    return parse_numbers_range<T, parse_decimal16_ssse3>(token, begin, end,
+                                                         out, errors);
+  }
+#endif
+  return parse_numbers_range<T, parse_decimal16_scalar>(token, begin, end, out,
+                                                        errors);
+}
+
+// 把 [0, n) 平均分给不超过 threads 个线程，每个线程至少处理 grain 个
+// token，当前线程处理第一段。
+template <typename T, typename Token>
+size_t parse_numbers_parallel(const Token &token, size_t n, T *out,
+                              std::errc *errors, size_t threads) {
+  constexpr size_t grain = 1 << 16;
+  if (!threads) {
+    threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, (n + grain - 1) / grain);
+  if (threads <= 1) { return parse_numbers_chunk(token, 0, n, out, errors); }
+
+  auto chunk = (n + threads - 1) / threads;
+  std::vector<size_t> failures(threads);
+  {
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    scope_exit join([&]() {
+      for (auto &w : workers) {
+        w.join();
+      }
+    });
+    for (size_t t = 1; t < threads; t++) {
+      workers.emplace_back([&, t]() {
+        auto begin = std::min(n, t * chunk);
+        auto end = std::min(n, begin + chunk);
+        failures[t] = parse_numbers_chunk(token, begin, end, out, errors);
+      });
+    }
+    failures[0] = parse_numbers_chunk(token, 0, chunk, out, errors);
+  }
+  return std::accumulate(failures.begin(), failures.end(), size_t(0));
+}
+
+} // namespace detail
+
+// 把 tokens[0, n) 逐个解析为 T 并写入 out[0, n)。每个 token 必须整个是
+// 一个数（语法同 parse_number），否则该项失败，out 中对应的值为 0；errors
+// 不为 nullptr 时写入每一项的 ec。返回失败的项数。
+//
+// 不超过 16 位的十进制整数用 SIMD（没有 SSSE3 时用 SWAR）一次验证并转换。
+// token 很多时分给 threads 个线程并行解析（0 表示硬件线程数），每个线程
+// 至少处理 65536 个 token。
+template <typename T>
+size_t parse_numbers(const std::string_view *tokens, size_t n, T *out,
+                     std::errc *errors = nullptr, size_t threads = 0) {
+  return detail::parse_numbers_parallel(
+      [tokens](size_t k) { return tokens[k]; }, n, out, errors, threads);
+}
+
+// 同上，但 token 由一个缓冲区和 n + 1 个偏移给出（与 Arrow 的字符串列
+// 相同）：第 k 个 token 是 [buffer + offsets[k], buffer + offsets[k + 1])。
+template <typename T>
+size_t parse_numbers(const char *buffer, const size_t *offsets, size_t n,
+                     T *out, std::errc *errors = nullptr, size_t threads = 0) {
+  return detail::parse_numbers_parallel(
+      [buffer, offsets](size_t k) {
+        return std::string_view(buffer + offsets[k],
+                                offsets[k + 1] - offsets[k]);
+      },
+      n, out, errors, threads);
+}
+
+// format_float 最多写入的字节数。
+inline constexpr size_t FloatFormatMaxLength = 32;
+
+namespace detail {
+
+// Ryu 使用的 5 的幂，都规范化为 Pow5Bits 位：pow5[i] 是 5^i 的最高
+// Pow5Bits 位（向下截断），pow5_inv[i] 是 2^(pow5_bits(i) - 1 + Pow5Bits)
+// / 5^i 向下取整后加 1。以 {低 64 位, 高 64 位} 保存。
+constexpr int Pow5Bits = 125;
+
+struct Pow5Tables {
+  std::array<std::array<uint64_t, 2>, 326> pow5;
+  std::array<std::array<uint64_t, 2>, 342> pow5_inv;
+};
+
+// ceil(log2(5^e))，e 为 0 时为 1。
+constexpr int pow5_bits(int e) { return ((e * 1217359) >> 19) + 1; }
+
+// floor(log10(2^e)) 和 floor(log10(5^e))。
+constexpr int log10_pow2(int e) { return (e * 78913) >> 18; }
+constexpr int log10_pow5(int e) { return (e * 732923) >> 20; }
+
+// 首次使用时用 BigInt 生成，方法同 pow10_table。
+inline const Pow5Tables &pow5_tables() {
+  static const auto tables = []() {
+    Pow5Tables t{};
+    // floor(big / 2^low) 的低 128 位，low 可以为负。
+    auto bits_from = [](const BigInt &big, int low) {
+      std::array<uint64_t, 2> r{};
+      for (int k = 0; k < 128; k++) {
+        r[k / 64] |= big.bit(low + k) << (k % 64);
+      }
+      return r;
+    };
+    BigInt big(0);
+    for (int i = 0; i < static_cast<int>(t.pow5.size()); i++) {
+      t.pow5[i] = bits_from(big, pow5_bits(i) - Pow5Bits);
+      big.mul5();
+    }
+    big = BigInt(BigInt::Bits - 1);
+    for (int i = 0; i < static_cast<int>(t.pow5_inv.size()); i++) {
+      // big 为 floor(2^1279 / 5^i)。
+      auto &r = t.pow5_inv[i];
+      r = bits_from(big, BigInt::Bits - 1 - (pow5_bits(i) - 1 + Pow5Bits));
+      if (++r[0] == 0) { r[1]++; }
+      big.div5();
+    }
+    return t;
+  }();
+  return tables;
+}
+
+// (m * mul) >> j，其中 mul 为 128 位，64 <= j < 128。
+inline uint64_t mul_shift_64(uint64_t m, const std::array<uint64_t, 2> &mul,
+                             int j) {
+  uint64_t lo0;
+  auto hi0 = mul_64x64(m, mul[0], lo0);
+  uint64_t lo1;
+  auto hi1 = mul_64x64(m, mul[1], lo1);
+  auto lo = lo1 + hi0;
+  auto hi = hi1 + (lo < hi0);
+  auto dist = j - 64;
+  return ((hi << 1) << (63 - dist)) | (lo >> dist);
+}
+
+inline bool multiple_of_pow5(uint64_t v, int p) {
+  auto count = 0;
+  for (; v % 5 == 0; v /= 5) {
+    count++;
+  }
+  return count >= p;
+}
+
+inline bool multiple_of_pow2(uint64_t v, int p) {
+  return !(v & ((uint64_t(1) << p) - 1));
+}
+
+// Ryu：在所有能被解析回 value 的十进制数 digits * 10^exp10 中，求位数
+// 最少的那个，位数相同时取最接近 value 的。value 必须是有限的正数。
+// 见 Ulf Adams, "Ryū: fast float-to-string conversion"。
+template <typename T>
+void shortest_decimal(T value, uint64_t &digits, int &exp10) {
+  using Traits = FloatTraits<T>;
+  constexpr int mantissa_bits = Traits::MantissaBits;
+  constexpr int bias = -Traits::Bias;
+
+  typename Traits::Bits bits;
+  std::memcpy(&bits, &value, sizeof(T));
+  uint64_t ieee_mantissa = bits & ((uint64_t(1) << mantissa_bits) - 1);
+  auto ieee_exponent = static_cast<int>(
+      (bits >> mantissa_bits) & ((1u << Traits::ExponentBits) - 1));
+
+  // value = m2 * 2^e2，多减的 2 为下面的 4 * m2 留出位置。
+  int e2;
+  uint64_t m2;
+  if (!ieee_exponent) {
+    e2 = 1 - bias - mantissa_bits - 2;
+    m2 = ieee_mantissa;
+  } else {
+    e2 = ieee_exponent - bias - mantissa_bits - 2;
+    m2 = (uint64_t(1) << mantissa_bits) | ieee_mantissa;
+  }
+  auto accept_bounds = !(m2 & 1);
+
+  // 舍入区间为 [mv - 1 - mm_shift, mv + 2] / 4 * 2^e2，尾数为 0 时下界
+  // 离得更近。
+  auto mv = 4 * m2;
+  uint64_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+  // 把区间的两端和 value 本身换算为十进制 vm、vp、vr * 10^e10，同时记录
+  // 换算时舍去的部分是否全为 0。
+  const auto &tables = pow5_tables();
+  uint64_t vr, vp, vm;
+  int e10;
+  auto vm_trailing_zeros = false;
+  auto vr_trailing_zeros = false;
+  if (e2 >= 0) {
+    auto q = log10_pow2(e2) - (e2 > 3);
+    e10 = q;
+    auto k = Pow5Bits + pow5_bits(q) - 1;
+    auto i = -e2 + q + k;
+    const auto &mul = tables.pow5_inv[q];
+    vr = mul_shift_64(mv, mul, i);
+    vp = mul_shift_64(mv + 2, mul, i);
+    vm = mul_shift_64(mv - 1 - mm_shift, mul, i);
+    if (q <= 21) {
+      // mv 不超过 2^55 < 5^24，只有 q 较小时才可能被 5^q 整除。
+      if (mv % 5 == 0) {
+        vr_trailing_zeros = multiple_of_pow5(mv, q);
+      } else if (accept_bounds) {
+        vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+      } else {
+        vp -= multiple_of_pow5(mv + 2, q);
+      }
+    }
+  } else {
+    auto q = log10_pow5(-e2) - (-e2 > 1);
+    e10 = q + e2;
+    auto i = -e2 - q;
+    auto k = pow5_bits(i) - Pow5Bits;
+    auto j = q - k;
+    const auto &mul = tables.pow5[i];
+    vr = mul_shift_64(mv, mul, j);
+    vp = mul_shift_64(mv + 2, mul, j);
+    vm = mul_shift_64(mv - 1 - mm_shift, mul, j);
+    if (q <= 1) {
+      vr_trailing_zeros = true;
+      if (accept_bounds) {
+        vm_trailing_zeros = mm_shift == 1;
+      } else {
+        vp--;
+      }
+    } else if (q < 63) {
+      vr_trailing_zeros = multiple_of_pow2(mv, q);
+    }
+  }
+
+  // 在 vp 与 vm 仍有不同的高位时不断去掉最低位。
+  auto removed = 0;
+  uint8_t last_removed_digit = 0;
+  uint64_t output;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    // 需要精确处理边界和恰好一半的情况，很少发生。
+    for (; vp / 10 > vm / 10; removed++) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed_digit == 0;
+      last_removed_digit = static_cast<uint8_t>(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+    }
+    if (vm_trailing_zeros) {
+      for (; vm % 10 == 0; removed++) {
+        vr_trailing_zeros &= last_removed_digit == 0;
+        last_removed_digit = static_cast<uint8_t>(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+      }
+    }
+    if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) {
+      last_removed_digit = 4;  // 恰好一半，取偶数
+    }
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+                   last_removed_digit >= 5);
+  } else {
+    auto round_up = false;
+    for (; vp / 10 > vm / 10; removed++) {
+      round_up = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+    }
+    output = vr + (vr == vm || round_up);
+  }
+  digits = output;
+  exp10 = e10 + removed;
+}
+
+} // namespace detail
+
+// 把 value 格式化为能够精确解析回 value（用 parse_float）的最短十进制
+// 表示，写入 buff，返回写入的长度（不写入结尾的 '\0'）。buff 至少要有
+// FloatFormatMaxLength 字节。
+//
+// 格式同 JavaScript 的 Number.prototype.toString：1e-7 <= |value| < 1e21
+// 时使用普通的小数，例如 "0.1"、"100"、"-2.5"，否则使用指数形式，例如
+// "1e+21"、"1.5e-7"。-0 写作 "-0"，非有限值写作 "inf"、"-inf" 和 "nan"。
+template <typename T> size_t format_float(T value, char *buff) {
+  static_assert(std::is_same<T, float>::value ||
+                std::is_same<T, double>::value);
+  auto p = buff;
+  if (std::isnan(value)) {
+    std::memcpy(p, "nan", 3);
+    return 3;
+  }
+  if (std::signbit(value)) {
+    *p++ = '-';
+    value = -value;
+  }
+  if (std::isinf(value)) {
+    std::memcpy(p, "inf", 3);
+    return static_cast<size_t>(p - buff) + 3;
+  }
+  if (value == 0) {
+    *p++ = '0';
+    return static_cast<size_t>(p - buff);
+  }
+
+  uint64_t digits;
+  int exp10;
+  detail::shortest_decimal(value, digits, exp10);
+  char d[20];
+  auto k = 0;
+  for (; digits; digits /= 10) {
+    d[k++] = static_cast<char>('0' + digits % 10);
+  }
+  std::reverse(d, d + k);
+
+  // value = 0.d[0]d[1]...d[k-1] * 10^n
+  auto n = k + exp10;
+  if (k <= n && n <= 21) {
+    std::memcpy(p, d, static_cast<size_t>(k));
+    p += k;
+    std::memset(p, '0', static_cast<size_t>(n - k));
+    p += n - k;
+  } else if (0 < n && n <= 21) {
+    std::memcpy(p, d, static_cast<size_t>(n));
+    p += n;
+    *p++ = '.';
+    std::memcpy(p, d + n, static_cast<size_t>(k - n));
+    p += k - n;
+  } else if (-6 < n && n <= 0) {
+    *p++ = '0';
+    *p++ = '.';
+    std::memset(p, '0', static_cast<size_t>(-n));
+    p += -n;
+    std::memcpy(p, d, static_cast<size_t>(k));
+    p += k;
+  } else {
+    *p++ = d[0];
+    if (k > 1) {
+      *p++ = '.';
+      std::memcpy(p, d + 1, static_cast<size_t>(k - 1));
+      p += k - 1;
+    }
+    *p++ = 'e';
+    auto e = n - 1;
+    *p++ = e < 0 ? '-' : '+';
+    if (e < 0) { e = -e; }
+    char ebuff[4];
+    auto el = 0;
+    for (; e; e /= 10) {
+      ebuff[el++] = static_cast<char>('0' + e % 10);
+    }
+    while (el) {
+      *p++ = ebuff[--el];
+    }
+  }
+  return static_cast<size_t>(p - buff);
+}
+
+template <typename T> std::string format_float(T value) {
+  char buff[FloatFormatMaxLength];
+  return std::string(buff, format_float(value, buff));
+}
+
+/*-----------------------------------------------------------------------------
+ *  token_to_number_ - This function should be removed eventually
+ *---------------------------------------------------------------------------*/
+
+// 将字符串转换为数字。保持原来的行为：整数用 from_chars 解析十进制前缀
+// （不接受正号、前导空白、进制前缀和分隔符，失败时为 0），浮点数用
+// istringstream。整个 token 都是普通的十进制浮点数时结果与 istringstream
+// 相同，改用 parse_float，其余情况仍然交给 istringstream。
+template <typename T> T token_to_number_(std::string_view sv) {
+  T n = 0;
+#if __has_include(<charconv>)
+  if constexpr (!std::is_floating_point<T>::value) {
+    std::from_chars(sv.data(), sv.data() + sv.size(), n);
+#else
+  if constexpr (false) {
+#endif
+  } else {
+    if constexpr (!std::is_same<T, long double>::value) {
+      auto plain = sv.find_first_not_of("0123456789+-.eE") == sv.npos;
+      auto r = parse_float<T>(sv);
+      if (plain && r.ec == std::errc{} && r.consumed == sv.size()) {
+        return r.value;
+      }
+    }
+    auto s = std::string(sv);
+    std::istringstream ss(s);
+    ss >> n;
+  }
+  return n;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Trie
+ *---------------------------------------------------------------------------*/
+
+namespace detail {
+
+// 字节的集合。除 256 位的位图外还保存 shufti 所需的两张表：字节 c 的高
+// 4 位 h 属于第 h % 8 个桶，lo[c & 15] 和 hi[h] 的按位与不为 0 表示 c
+// 可能在集合中（同一个桶里有多个高 4 位时会有误报）。
+struct ByteSet {
+  uint64_t bits[4] = {};
+  uint8_t lo[16] = {};
+  uint8_t hi[16] = {};
+
+  void insert(uint8_t c) {
+    bits[c >> 6] |= uint64_t(1) << (c & 63);
+    auto bucket = static_cast<uint8_t>(1u << ((c >> 4) & 7));
+    lo[c & 15] |= bucket;
+    hi[c >> 4] |= bucket;
+  }
+
+  bool contains(uint8_t c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+};
+
+// 返回 s 中第一个属于 set 的字节的位置，没有则返回 n。SIMD 实现可能
+// 返回误报的位置，调用者需要自己确认。
+inline size_t find_byte_in_set_scalar(const char *s, size_t n,
+                                      const ByteSet &set) {
+  for (size_t i = 0; i < n; i++) {
+    if (set.contains(static_cast<uint8_t>(s[i]))) { return i; }
+  }
+  return n;
+}
+
+#ifdef PEG_USE_X86_SIMD
+PEG_TARGET("ssse3")
+inline size_t find_byte_in_set_ssse3(const char *s, size_t n,
+                                     const ByteSet &set) {
+  const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.lo));
+  const auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.hi));
+  const auto low4 = _mm_set1_epi8(0x0F);
+  const auto zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    auto l = _mm_shuffle_epi8(lo, _mm_and_si128(v, low4));
+    auto h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+    auto miss = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero));
+    auto mask = static_cast<uint32_t>(~miss) & 0xFFFF;
+    if (mask) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+  }
+  return i + find_byte_in_set_scalar(s + i, n - i, set);
+}
+
+PEG_TARGET("avx2")
+inline size_t find_byte_in_set_avx2(const char *s, size_t n,
+                                    const ByteSet &set) {
+  const auto lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.lo)));
+  const auto hi = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.hi)));
+  const auto low4 = _mm256_set1_epi8(0x0F);
+  const auto zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    auto l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, low4));
+    auto h = _mm256_shuffle_epi8(
+        hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4));
+    auto miss =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero));
+    auto mask = ~static_cast<uint32_t>(miss);
+    if (mask) { return i + static_cast<size_t>(__builtin_ctz(mask)); }
+  }
+  return i + find_byte_in_set_scalar(s + i, n - i, set);
+}
+#endif
+
+inline size_t find_byte_in_set(const char *s, size_t n, const ByteSet &set) {
+  using Kernel = size_t (*)(const char *, size_t, const ByteSet &);
+  static const Kernel kernel = []() -> Kernel {
+    switch (simd_level()) {
+#ifdef PEG_USE_X86_SIMD
+    case SimdLevel::AVX512:
+    case SimdLevel::AVX2: return find_byte_in_set_avx2;
+    case SimdLevel::SSSE3: return find_byte_in_set_ssse3;
+#endif
+    default: return find_byte_in_set_scalar;
+    }
+  }();
+  return kernel(s, n, set);
+}
+
+// 用不超过 threads 个线程（0 表示硬件线程数）排序 [first, last)：每个线程
+// 先排序一段，之后逐轮两两合并相邻的段。每个线程至少处理 grain 个元素。
+template <typename It, typename Compare>
+void parallel_sort(It first, It last, Compare comp, size_t threads) {
+  constexpr size_t grain = 1 << 14;
+  auto n = static_cast<size_t>(last - first);
+  if (!threads) {
+    threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, (n + grain - 1) / grain);
+  if (threads <= 1) {
+    std::sort(first, last, comp);
+    return;
+  }
+
+  // 并行执行 task(0) 到 task(count - 1)，当前线程执行 task(0)。
+  auto run = [](size_t count, const auto &task) {
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    scope_exit join([&]() {
+      for (auto &w : workers) {
+        w.join();
+      }
+    });
+    for (size_t t = 1; t < count; t++) {
+      workers.emplace_back(task, t);
+    }
+    task(0);
+  };
+
+  auto chunk = (n + threads - 1) / threads;
+  run(threads, [&](size_t t) {
+    auto begin = std::min(n, t * chunk);
+    std::sort(first + begin, first + std::min(n, begin + chunk), comp);
+  });
+  for (auto width = chunk; width < n; width *= 2) {
+    run((n + 2 * width - 1) / (2 * width), [&](size_t t) {
+      auto begin = t * 2 * width;
+      auto mid = std::min(n, begin + width);
+      std::inplace_merge(first + begin, first + mid,
+                         first + std::min(n, mid + width), comp);
+    });
+  }
+}
+
+} // namespace detail
+
+// Trie 匹配时如何比较大小写。
+enum class CaseFolding : uint8_t {
+  None,     // 逐字节比较
+  Ascii,    // 不区分 ASCII 字母的大小写
+  Unicode,  // 对 UTF-8 文本按 fold_codepoint 折叠
+};
+
+// 双数组 Trie。状态 s 经过字节 c 转移到 t = base(s) + c + 1，当且仅当
+// check(t) == s，所以匹配时每个输入字节只需一次数组访问。
+//
+// 构建时同时计算 Aho-Corasick 的失败链接（到最长的真后缀所在的状态）和
+// 输出链接（沿失败链接第一个是关键字的状态），用于 scan。
+//
+// 不区分大小写时关键字在构建时折叠，匹配时查表逐字节折叠输入，不复制
+// 输入。CaseFolding::Ascii 与区分大小写时走同一条路径，只是表不同；
+// CaseFolding::Unicode 对非 ASCII 字符先解码、折叠再重新编码，关键字应当
+// 是合法的 UTF-8。
+//
+// 构建好的 Trie 可以用 save 保存为映像。映像中只有定长整数，不含指针，
+// 用 view 可以直接在可信的映像（例如只读映射的文件）上匹配，不需要任何
+// 构建；不可信的映像用 verified_view 或 load，它们会先检查内容。
+// 复制 Trie 时共享同一份只读的数据。
+class Trie {
+public:
+  Trie() = default;
+  Trie(const Trie &) = default;
+
+  // 构建时先把（折叠后的）关键字排序，已经有序时跳过排序。关键字很多时
+  // 可以用 threads 个线程并行排序（0 表示硬件线程数）。
+  Trie(const std::vector<std::string> &items,
+       CaseFolding folding = CaseFolding::None, size_t threads = 1)
+      : folding_(folding) {
+    for (size_t c = 0; c < fold_.size(); c++) {
+      fold_[c] = static_cast<uint8_t>(c);
+      if (folding != CaseFolding::None && 'A' <= c && c <= 'Z') {
+        fold_[c] += 32;
+      }
+    }
+
+    std::vector<std::string> folded;
+    std::vector<std::string_view> keys(items.size());
+    if (folding == CaseFolding::None) {
+      std::copy(items.begin(), items.end(), keys.begin());
+    } else {
+      folded.reserve(items.size());
+      for (const auto &item : items) {
+        folded.push_back(fold(item));
+      }
+      std::copy(folded.begin(), folded.end(), keys.begin());
+    }
+
+    // 按关键字的字节序排序，相同的关键字按下标排序，使第一个排在最前。
+    std::vector<int32_t> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](int32_t a, int32_t b) {
+      auto r = keys[a].compare(keys[b]);
+      return r < 0 || (r == 0 && a < b);
+    };
+    if (!std::is_sorted(order.begin(), order.end(), less)) {
+      detail::parallel_sort(order.begin(), order.end(), less, threads);
+    }
+
+    // 先一遍构建普通的树，再按广度优先的顺序把每个节点的子节点放进双数组。
+    auto nodes = build_nodes(keys, order);
+    for (auto c = nodes[0].first_child; c >= 0; c = nodes[c].next_sibling) {
+      first_bytes_.insert(nodes[c].label);
+    }
+    // 输入中折叠前的字节也要能通过预筛选。
+    for (size_t c = 0; c < fold_.size(); c++) {
+      if (first_bytes_.contains(fold_[c]) ||
+          (folding == CaseFolding::Unicode && 0xC2 <= c && c <= 0xF4)) {
+        first_bytes_.insert(static_cast<uint8_t>(c));
+      }
+    }
+    auto storage = std::make_shared<Storage>();
+    link(place(nodes, storage->units), storage->units, storage->links);
+    units_ = storage->units.data();
+    links_ = storage->links.data();
+    unit_count_ = storage->units.size();
+    storage_ = std::move(storage);
+  }
+
+  // 在 save 写出的映像上直接构造 Trie，不复制数据。data 至少要按 8 字节
+  // 对齐，并且在返回的 Trie（及其副本）使用期间保持有效。
+  //
+  // 为了没有构建的开销，这里只检查文件头和大小（不符时抛出
+  // std::runtime_error），不检查各个状态，所以映像必须是可信的，例如由
+  // 本服务自己用 save 写出。内容损坏的映像会使 match 和 scan 越界读取。
+  // 不可信的映像用 verified_view。
+  static Trie view(const void *data, size_t size) {
+    if (reinterpret_cast<uintptr_t>(data) % alignof(Header)) {
+      throw std::runtime_error("trie image is not aligned");
+    }
+    if (size < sizeof(Header)) {
+      throw std::runtime_error("trie image is too short");
+    }
+    Header h;
+    std::memcpy(&h, data, sizeof(Header));
+    if (std::memcmp(h.magic, ImageMagic, sizeof(h.magic)) ||
+        h.version != ImageVersion || h.byte_order != ImageByteOrder ||
+        h.folding > static_cast<uint8_t>(CaseFolding::Unicode)) {
+      throw std::runtime_error("invalid trie image");
+    }
+    auto unit_size = sizeof(Unit) + sizeof(Link);
+    if (h.unit_count < 257 ||
+        h.unit_count > static_cast<uint64_t>(
+                           std::numeric_limits<int32_t>::max()) ||
+        h.unit_count != (size - sizeof(Header)) / unit_size ||
+        (size - sizeof(Header)) % unit_size) {
+      throw std::runtime_error("trie image has a wrong size");
+    }
+
+    Trie trie;
+    auto p = static_cast<const char *>(data) + sizeof(Header);
+    trie.unit_count_ = static_cast<size_t>(h.unit_count);
+    trie.units_ = reinterpret_cast<const Unit *>(p);
+    trie.links_ =
+        reinterpret_cast<const Link *>(p + trie.unit_count_ * sizeof(Unit));
+    trie.max_depth_ = static_cast<size_t>(h.max_depth);
+    trie.first_bytes_ = h.first_bytes;
+    trie.folding_ = static_cast<CaseFolding>(h.folding);
+    std::memcpy(trie.fold_.data(), h.fold, sizeof(h.fold));
+    return trie;
+  }
+
+  // 同 view，但还会逐个检查状态，保证 match 和 scan 不会越界，也不会
+  // 沿链接陷入循环，否则抛出 std::runtime_error。代价与映像大小成线性。
+  static Trie verified_view(const void *data, size_t size) {
+    auto trie = view(data, size);
+    if (!trie.verify()) { throw std::runtime_error("corrupt trie image"); }
+    return trie;
+  }
+
+  // 读入 save 写出的映像文件，并像 verified_view 一样检查。
+  static Trie load(const std::string &path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) { throw std::runtime_error("cannot open " + path); }
+    auto size = static_cast<size_t>(in.tellg());
+    // 以 uint64_t 为单位分配以保证对齐。
+    auto buff = std::make_shared<std::vector<uint64_t>>((size + 7) / 8);
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(buff->data()),
+                 static_cast<std::streamsize>(size))) {
+      throw std::runtime_error("cannot read " + path);
+    }
+    auto trie = verified_view(buff->data(), size);
+    trie.storage_ = std::move(buff);
+    return trie;
+  }
+
+  void save(std::ostream &out) const {
+    if (!units_) { throw std::runtime_error("cannot save an empty trie"); }
+    Header h{};
+    std::memcpy(h.magic, ImageMagic, sizeof(h.magic));
+    h.version = ImageVersion;
+    h.byte_order = ImageByteOrder;
+    h.unit_count = unit_count_;
+    h.max_depth = max_depth_;
+    h.folding = static_cast<uint8_t>(folding_);
+    std::memcpy(h.fold, fold_.data(), sizeof(h.fold));
+    h.first_bytes = first_bytes_;
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char *>(units_),
+              static_cast<std::streamsize>(unit_count_ * sizeof(Unit)));
+    out.write(reinterpret_cast<const char *>(links_),
+              static_cast<std::streamsize>(unit_count_ * sizeof(Link)));
+  }
+
+  void save(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) { throw std::runtime_error("cannot open " + path); }
+    save(out);
+    if (!out.flush()) { throw std::runtime_error("cannot write " + path); }
+  }
+
+  size_t match(const char *text, size_t text_len) const {
+    size_t index;
+    return match(text, text_len, index);
+  }
+
+  // 同上，匹配成功时还通过 index 返回最长的关键字在构造时的下标（重复的
+  // 关键字取第一个），失败时不修改 index。
+  size_t match(const char *text, size_t text_len, size_t &index) const {
+    if (!units_) { return 0; }
+    size_t match_len = 0;
+    int32_t value = -1;
+    int32_t s = 0;
+    if (folding_ == CaseFolding::Unicode) {
+      for (size_t i = 0; i < text_len;) {
+        char buff[4];
+        auto n = fold_at(text, text_len, i, buff);
+        size_t j = 0;
+        for (; j < n; j++) {
+          auto t = units_[s].base + static_cast<uint8_t>(buff[j]) + 1;
+          if (units_[t].check != s) { break; }
+          s = t;
+        }
+        if (j < n) { break; }
+        if (units_[s].value >= 0) {
+          match_len = i;
+          value = units_[s].value;
+        }
+      }
+    } else {
+      for (size_t i = 0; i < text_len; i++) {
+        auto t = units_[s].base + fold_[static_cast<uint8_t>(text[i])] + 1;
+        if (units_[t].check != s) { break; }
+        s = t;
+        if (units_[s].value >= 0) {
+          match_len = i + 1;
+          value = units_[s].value;
+        }
+      }
+    }
+    if (value >= 0) { index = static_cast<size_t>(value); }
+    return match_len;
+  }
+
+  // 一次线性扫描找出 text 中所有关键字的所有出现（包括互相重叠的），对每
+  // 个出现调用 callback(offset, length, index)，index 是关键字在构造时的
+  // 下标（重复的关键字取第一个）。同一位置结束的多个关键字按长度从长到短
+  // 报告。处于根状态时用 SIMD 跳到下一个可能是关键字首字节的位置。
+  template <typename Callback>
+  void scan(const char *text, size_t text_len, Callback callback) const {
+    if (!units_) { return; }
+    if (folding_ == CaseFolding::Unicode) {
+      scan_unicode(text, text_len, callback);
+      return;
+    }
+    int32_t s = 0;
+    for (size_t i = 0; i < text_len; i++) {
+      if (!s) {
+        i += detail::find_byte_in_set(text + i, text_len - i, first_bytes_);
+        if (i == text_len) { break; }
+      }
+      s = next(s, fold_[static_cast<uint8_t>(text[i])]);
+      auto o = units_[s].value >= 0 ? s : links_[s].output;
+      for (; o; o = links_[o].output) {
+        auto len = static_cast<size_t>(links_[o].depth);
+        callback(i + 1 - len, len, static_cast<size_t>(units_[o].value));
+      }
+    }
+  }
+
+  CaseFolding folding() const { return folding_; }
+
+private:
+  struct Node {
+    int32_t first_child = -1;
+    int32_t next_sibling = -1;  // 同一节点的子节点按字节升序串成链表
+    int32_t value = -1;
+    uint8_t label = 0;
+  };
+
+  struct Unit {
+    int32_t base = 0;
+    int32_t check = -1;  // 父状态，-1 表示空位
+    int32_t value = -1;  // 以此状态结束的关键字的下标，-1 表示不是关键字
+  };
+
+  // Aho-Corasick 的链接。根状态 0 不是关键字，所以 output 为 0 表示没有。
+  struct Link {
+    int32_t fail = 0;
+    int32_t output = 0;
+    int32_t depth = 0;  // 状态对应的字符串的长度
+  };
+
+  // 检查 match、scan 和 next 依赖的性质：
+  // - 每个 base + 256 都在数组内，所以任何转移都不会越界；
+  // - check、fail 和 output 都指向数组内，output 指向关键字；
+  // - 状态是其父状态的子节点，深度比父状态大 1，所以深度就是从根走到
+  //   该状态的字节数；
+  // - 沿 fail 和 output 深度严格递减，所以总会回到根状态；
+  // - max_depth 等于实际的最大深度（它决定 scan_unicode 的缓冲区大小）。
+  bool verify() const {
+    auto n = static_cast<int64_t>(unit_count_);
+    const auto &root = links_[0];
+    if (root.fail || root.output || root.depth) { return false; }
+    int32_t max_depth = 0;
+    for (int64_t i = 0; i < n; i++) {
+      const auto &u = units_[i];
+      const auto &l = links_[i];
+      if (u.base < 0 || u.base + int64_t(256) >= n || u.check < -1 ||
+          u.check >= n || u.value < -1 || l.depth < 0 || l.depth >= n ||
+          l.fail < 0 || l.fail >= n || l.output < 0 || l.output >= n) {
+        return false;
+      }
+      if (u.check >= 0) {
+        auto base = units_[u.check].base;
+        if (i <= base || i > base + 256 ||
+            l.depth != links_[u.check].depth + 1) {
+          return false;
+        }
+      }
+      if (i && ((l.fail && links_[l.fail].depth >= l.depth) ||
+                (l.output && (links_[l.output].depth >= l.depth ||
+                              units_[l.output].value < 0)))) {
+        return false;
+      }
+      max_depth = std::max(max_depth, l.depth);
+    }
+    return max_depth_ == static_cast<size_t>(max_depth);
+  }
+
+  // 自己构建的 Trie 的数据。
+  struct Storage {
+    std::vector<Unit> units;
+    std::vector<Link> links;
+  };
+
+  // 映像的开头。之后依次是 unit_count 个 Unit 和 unit_count 个 Link，都按
+  // 本机字节序保存。
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // 按本机字节序写入的 ImageByteOrder
+    uint64_t unit_count;
+    uint64_t max_depth;
+    uint8_t folding;
+    uint8_t fold[256];
+    uint8_t reserved[7];
+    detail::ByteSet first_bytes;
+  };
+
+  static constexpr char ImageMagic[8] = {'P', 'E', 'G', 'T', 'R', 'I', 'E'};
+  static constexpr uint32_t ImageVersion = 1;
+  static constexpr uint32_t ImageByteOrder = 0x01020304;
+
+  // 构建时把空位串成双向循环链表，以从不分配的位置 0 为表头，查找 base
+  // 时只需访问空位。fails 是空位作为第一个子节点的位置失败的次数。
+  struct FreeList {
+    std::vector<int32_t> next{0};
+    std::vector<int32_t> prev{0};
+    std::vector<uint8_t> fails{0};
+  };
+
+  // 多次放不下的空位多半在已经很满的区域里，把它移出链表，使查找 base
+  // 的总时间与状态数成线性。它仍然可以放第一个以外的子节点。
+  static constexpr uint8_t MaxFreeFails = 16;
+
+  // 移出链表的位置指向自己，所以重复移出没有影响。
+  static void unlink(FreeList &free, int32_t i) {
+    free.next[free.prev[i]] = free.next[i];
+    free.prev[free.next[i]] = free.prev[i];
+    free.next[i] = free.prev[i] = i;
+  }
+
+  static void grow(std::vector<Unit> &units, FreeList &free, size_t size) {
+    auto old = units.size();
+    if (size <= old) { return; }
+    units.resize(size);
+    free.next.resize(size);
+    free.prev.resize(size);
+    free.fails.resize(size);
+    for (auto i = static_cast<int32_t>(old); i < static_cast<int32_t>(size);
+         i++) {
+      free.prev[i] = free.prev[0];
+      free.next[i] = 0;
+      free.next[free.prev[0]] = i;
+      free.prev[0] = i;
+    }
+  }
+
+  // 按 folding_ 折叠关键字。
+  std::string fold(const std::string &item) const {
+    if (folding_ != CaseFolding::Unicode) {
+      std::string out(item);
+      for (auto &ch : out) {
+        ch = static_cast<char>(fold_[static_cast<uint8_t>(ch)]);
+      }
+      return out;
+    }
+    std::string out;
+    for (size_t i = 0; i < item.size();) {
+      char buff[4];
+      out.append(buff, fold_at(item.data(), item.size(), i, buff));
+    }
+    return out;
+  }
+
+  // 折叠 text[i] 开始的字符，写入 buff 并返回长度，i 移到该字符之后。
+  // 非法的 UTF-8 序列和不需要折叠的字符逐字节原样输出。
+  size_t fold_at(const char *text, size_t text_len, size_t &i,
+                 char *buff) const {
+    auto b = static_cast<uint8_t>(text[i]);
+    if (b >= 0x80) {
+      size_t bytes;
+      char32_t cp;
+      if (decode_codepoint_strict(text + i, text_len - i, bytes, cp)) {
+        auto folded = fold_codepoint(cp);
+        if (folded != cp) {
+          i += bytes;
+          return encode_codepoint(folded, buff);
+        }
+      }
+    }
+    buff[0] = static_cast<char>(fold_[b]);
+    i++;
+    return 1;
+  }
+
+  // 从状态 s 读入字节 c 后的状态，必要时沿失败链接回退。
+  int32_t next(int32_t s, uint8_t c) const {
+    for (;;) {
+      auto t = units_[s].base + c + 1;
+      if (units_[t].check == s) { return t; }
+      if (!s) { return 0; }
+      s = links_[s].fail;
+    }
+  }
+
+  // CaseFolding::Unicode 的 scan。折叠可能改变字符的编码长度，所以用一个
+  // 环形缓冲区记住最近 max_depth_ 个折叠后的字节各自来自输入的哪个位置。
+  template <typename Callback>
+  void scan_unicode(const char *text, size_t text_len,
+                    Callback &callback) const {
+    size_t ring = 1;
+    while (ring < max_depth_) {
+      ring *= 2;
+    }
+    std::vector<size_t> starts(ring);
+    size_t count = 0;  // 已读入的折叠后的字节数
+    int32_t s = 0;
+    for (size_t i = 0; i < text_len;) {
+      if (!s) {
+        i += detail::find_byte_in_set(text + i, text_len - i, first_bytes_);
+        if (i == text_len) { break; }
+      }
+      auto start = i;
+      char buff[4];
+      auto n = fold_at(text, text_len, i, buff);
+      for (size_t j = 0; j < n; j++) {
+        s = next(s, static_cast<uint8_t>(buff[j]));
+        starts[count++ & (ring - 1)] = start;
+      }
+      auto o = units_[s].value >= 0 ? s : links_[s].output;
+      for (; o; o = links_[o].output) {
+        auto depth = static_cast<size_t>(links_[o].depth);
+        auto offset = starts[(count - depth) & (ring - 1)];
+        callback(offset, i - offset, static_cast<size_t>(units_[o].value));
+      }
+    }
+  }
+
+  // 关键字有序时，新节点总是成为其父节点的最后一个子节点，所以一遍就能
+  // 按先序建好整棵树。path[d] 是上一个关键字长度为 d 的前缀对应的节点。
+  static std::vector<Node>
+  build_nodes(const std::vector<std::string_view> &keys,
+              const std::vector<int32_t> &order) {
+    std::vector<Node> nodes(1);
+    std::vector<int32_t> path{0};
+    std::string_view prev;
+    for (auto k : order) {
+      auto key = keys[k];
+      size_t common = 0;
+      auto limit = std::min(key.size(), prev.size());
+      while (common < limit && key[common] == prev[common]) {
+        common++;
+      }
+      // 排好序后 key 不可能是 prev 的真前缀，common < key.size() 或两者相同。
+      for (auto d = common; d < key.size(); d++) {
+        auto id = static_cast<int32_t>(nodes.size());
+        nodes.push_back(Node{-1, -1, -1, static_cast<uint8_t>(key[d])});
+        if (d == common && d + 1 < path.size()) {
+          nodes[path[d + 1]].next_sibling = id;
+        } else {
+          nodes[path[d]].first_child = id;
+        }
+        path.resize(d + 1);
+        path.push_back(id);
+      }
+      auto n = path[key.size()];
+      if (n && nodes[n].value < 0) { nodes[n].value = k; }
+      prev = key;
+    }
+    return nodes;
+  }
+
+  // 返回按广度优先顺序排列的非根状态。
+  static std::vector<int32_t> place(const std::vector<Node> &nodes,
+                                    std::vector<Unit> &units) {
+    units.assign(1, Unit{});
+    FreeList free;
+    int32_t max_base = 0;
+    std::vector<std::pair<int32_t, int32_t>> queue{{0, 0}};  // (节点, 状态)
+    for (size_t q = 0; q < queue.size(); q++) {
+      auto [n, s] = queue[q];
+      auto first = nodes[n].first_child;
+      if (first < 0) { continue; }
+      auto base = find_base(units, free, nodes, first);
+      units[s].base = base;
+      max_base = std::max(max_base, base);
+      for (auto child = first; child >= 0; child = nodes[child].next_sibling) {
+        auto t = base + nodes[child].label + 1;
+        units[t].check = s;
+        units[t].value = nodes[child].value;
+        unlink(free, t);
+        queue.emplace_back(child, t);
+      }
+    }
+    // 末尾留出空位，使任何状态的 base + c + 1 都不会越界。
+    units.resize(static_cast<size_t>(max_base) + 257);
+    std::vector<int32_t> order(queue.size() - 1);
+    for (size_t q = 1; q < queue.size(); q++) {
+      order[q - 1] = queue[q].second;
+    }
+    return order;
+  }
+
+  // 按广度优先的顺序计算链接，这样较浅的状态总是先算好。
+  void link(const std::vector<int32_t> &order, const std::vector<Unit> &units,
+            std::vector<Link> &links) {
+    links.assign(units.size(), Link{});
+    for (auto t : order) {
+      auto s = units[t].check;
+      auto c = t - units[s].base;
+      auto &l = links[t];
+      l.depth = links[s].depth + 1;
+      if (s) {
+        for (auto f = links[s].fail;; f = links[f].fail) {
+          auto g = units[f].base + c;
+          if (units[g].check == f) {
+            l.fail = g;
+            break;
+          }
+          if (!f) { break; }
+        }
+      }
+      l.output = units[l.fail].value >= 0 ? l.fail : links[l.fail].output;
+      max_depth_ = std::max(max_depth_, static_cast<size_t>(l.depth));
+    }
+  }
+
+  // 沿空位链表找到第一个 base，使每个子节点的位置 base + c + 1 都是空位。
+  static int32_t find_base(std::vector<Unit> &units, FreeList &free,
+                           const std::vector<Node> &nodes, int32_t first) {
+    int32_t first_code = nodes[first].label + 1;
+    for (auto pos = free.next[0];;) {
+      if (!pos) {
+        // 链表中没有合适的空位，在末尾追加。
+        pos = static_cast<int32_t>(units.size());
+        grow(units, free, units.size() + 256);
+      }
+      if (pos >= first_code) {
+        grow(units, free, static_cast<size_t>(pos) + 257);
+        auto base = pos - first_code;
+        auto fits = true;
+        for (auto c = nodes[first].next_sibling; c >= 0 && fits;
+             c = nodes[c].next_sibling) {
+          fits = units[base + nodes[c].label + 1].check < 0;
+        }
+        if (fits) { return base; }
+        if (++free.fails[pos] >= MaxFreeFails) {
+          auto next = free.next[pos];
+          unlink(free, pos);
+          pos = next;
+          continue;
+        }
+      }
+      pos = free.next[pos];
+    }
+  }
+
+  const Unit *units_ = nullptr;
+  const Link *links_ = nullptr;
+  size_t unit_count_ = 0;
+  size_t max_depth_ = 0;
+  detail::ByteSet first_bytes_;
+  CaseFolding folding_ = CaseFolding::None;
+  std::array<uint8_t, 256> fold_{};
+  // 自己构建或 load 时持有数据，view 时为空。
+  std::shared_ptr<const void> storage_;
+};
+
+// 关键字带有值的 Trie。一次遍历同时得到最长匹配的长度和它的值，不需要再
+// 用匹配到的子串查一次表。重复的关键字取第一个的值。
+template <typename T> class TrieMap {
+public:
+  struct MatchResult {
+    size_t length;   // 为 0 表示没有匹配
+    const T *value;  // 没有匹配时为 nullptr
+  };
+
+  TrieMap() = default;
+
+  explicit TrieMap(const std::vector<std::pair<std::string, T>> &items,
+                   CaseFolding folding = CaseFolding::None)
+      : trie_(keys(items), folding) {
+    values_.reserve(items.size());
+    for (const auto &item : items) {
+      values_.push_back(item.second);
+    }
+  }
+
+  MatchResult match_value(const char *text, size_t text_len) const {
+    size_t index;
+    auto len = trie_.match(text, text_len, index);
+    if (!len) { return {0, nullptr}; }
+    return {len, &values_[index]};
+  }
+
+  size_t match(const char *text, size_t text_len) const {
+    return trie_.match(text, text_len);
+  }
+
+  // 同 Trie::scan，但 callback 的参数是 (offset, length, const T &value)。
+  template <typename Callback>
+  void scan(const char *text, size_t text_len, Callback callback) const {
+    trie_.scan(text, text_len, [&](size_t offset, size_t len, size_t index) {
+      callback(offset, len, values_[index]);
+    });
+  }
+
+  const Trie &trie() const { return trie_; }
+
+private:
+  static std::vector<std::string>
+  keys(const std::vector<std::pair<std::string, T>> &items) {
+    std::vector<std::string> out;
+    out.reserve(items.size());
+    for (const auto &item : items) {
+      out.push_back(item.first);
+    }
+    return out;
+  }
+
+  Trie trie_;
+  std::vector<T> values_;
+};
+
+namespace detail {
+
+// 给关键字中出现的每个不同字节一个从 1 开始的编号（字节类），其他字节为
+// 0。StaticTrie 的转移表每个状态只需要字节类个数那么多列。
+template <typename Words>
+constexpr std::array<uint16_t, 256> static_trie_classes(const Words &words) {
+  std::array<bool, 256> used{};
+  for (size_t k = 0; k < std::size(words); k++) {
+    for (auto ch : std::string_view(words[k])) {
+      used[static_cast<uint8_t>(ch)] = true;
+    }
+  }
+  std::array<uint16_t, 256> classes{};
+  uint16_t n = 0;
+  for (size_t c = 0; c < classes.size(); c++) {
+    if (used[c]) { classes[c] = ++n; }
+  }
+  return classes;
+}
+
+// 稠密的转移表：next[s * Classes + 字节类]，0 表示没有转移（根状态 0 不会
+// 是转移的目标）。value 是以该状态结束的关键字的下标，-1 表示不是关键字。
+template <typename State, size_t States, size_t Classes>
+struct StaticTrieTable {
+  std::array<State, States * Classes> next{};
+  std::array<int32_t, States> value{};
+  size_t states = 1;
+};
+
+// States 至少要是实际的状态数，最多 1 加上所有关键字的长度之和。
+template <typename State, size_t States, size_t Classes, typename Words>
+constexpr StaticTrieTable<State, States, Classes>
+build_static_trie(const Words &words,
+                  const std::array<uint16_t, 256> &classes) {
+  StaticTrieTable<State, States, Classes> t;
+  for (auto &v : t.value) {
+    v = -1;
+  }
+  for (size_t k = 0; k < std::size(words); k++) {
+    size_t s = 0;
+    for (auto ch : std::string_view(words[k])) {
+      auto &n = t.next[s * Classes + classes[static_cast<uint8_t>(ch)]];
+      if (!n) { n = static_cast<State>(t.states++); }
+      s = n;
+    }
+    if (s && t.value[s] < 0) { t.value[s] = static_cast<int32_t>(k); }
+  }
+  return t;
+}
+
+template <typename Words> constexpr size_t total_length(const Words &words) {
+  size_t n = 0;
+  for (size_t k = 0; k < std::size(words); k++) {
+    n += std::string_view(words[k]).size();
+  }
+  return n;
+}
+
+} // namespace detail
+
+// 在编译期由固定的关键字表构建的 Trie，没有运行时的构建和堆分配，match
+// 是可以完全内联的 constexpr 函数。Words 必须是命名空间作用域或类的
+// static constexpr 数组，例如
+//
+//   static constexpr std::array<std::string_view, 3> keywords{
+//       "if", "else", "while"};
+//   auto len = peg::StaticTrie<keywords>::match(text, text_len);
+//
+// 转移表按字节类压缩，每个状态占 ClassCount 项。
+template <const auto &Words> class StaticTrie {
+  static constexpr auto classes_ = detail::static_trie_classes(Words);
+
+public:
+  static constexpr size_t ClassCount = []() {
+    size_t n = 0;
+    for (auto c : classes_) {
+      n = std::max<size_t>(n, c);
+    }
+    return n + 1;
+  }();
+  static constexpr size_t StateCount =
+      detail::build_static_trie<uint32_t, detail::total_length(Words) + 1,
+                                ClassCount>(Words, classes_)
+          .states;
+
+  // 同 Trie::match。
+  static constexpr size_t match(const char *text, size_t text_len) {
+    size_t index = 0;
+    return match(text, text_len, index);
+  }
+
+  static constexpr size_t match(const char *text, size_t text_len,
+                                size_t &index) {
+    size_t match_len = 0;
+    int32_t value = -1;
+    size_t s = 0;
+    for (size_t i = 0; i < text_len; i++) {
+      s = table_.next[s * ClassCount + classes_[static_cast<uint8_t>(text[i])]];
+      if (!s) { break; }
+      if (table_.value[s] >= 0) {
+        match_len = i + 1;
+        value = table_.value[s];
+      }
+    }
+    if (value >= 0) { index = static_cast<size_t>(value); }
+    return match_len;
+  }
+
+private:
+  using State =
+      typename std::conditional<(StateCount <= 0x10000), uint16_t,
+                                uint32_t>::type;
+
+  static constexpr auto table_ =
+      detail::build_static_trie<State, StateCount, ClassCount>(Words,
+                                                               classes_);
+};
+
+// 可以并发读、偶尔批量更新的关键字集合，按 RCU 的方式工作：读者用
+// snapshot 取得当前版本，只需几次原子操作，不加锁也不等待；写者在新的
+// 版本上应用更新后替换当前版本，等到所有可能还在使用旧版本的读者结束后
+// 再释放旧版本。
+//
+// 读者按线程分散到 ReaderSlots 个计数器上，每个计数器又按 epoch_ 的奇偶
+// 分成两个。写者两次翻转 epoch_，每次都等待翻转前的那一半计数归零，这样
+// 无论读者在翻转前还是翻转后进入，只要它可能拿到了旧版本就会被等到。
+// 长时间持有 Snapshot 会让写者一直等待；同一个线程在持有 Snapshot 时调用
+// 同一个 SharedTrie 的 update 会永远等待自己，造成死锁。
+class SharedTrie {
+  struct Version;
+
+public:
+  // 一个版本的只读视图。存在期间该版本不会被释放。
+  class Snapshot {
+  public:
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    Snapshot(Snapshot &&rhs) noexcept
+        : owner_(rhs.owner_), version_(rhs.version_), slot_(rhs.slot_),
+          parity_(rhs.parity_) {
+      rhs.owner_ = nullptr;
+    }
+
+    ~Snapshot() {
+      if (owner_) { owner_->slots_[slot_].readers[parity_].fetch_sub(1); }
+    }
+
+    const Trie &trie() const { return version_->trie; }
+    const Trie *operator->() const { return &version_->trie; }
+
+    // 这个版本的关键字，按字节序排列且没有重复。Trie 的 match 和 scan
+    // 返回的下标就是这里的下标。
+    const std::vector<std::string> &keywords() const {
+      return version_->keywords;
+    }
+
+  private:
+    friend class SharedTrie;
+
+    Snapshot(const SharedTrie *owner, const Version *version, size_t slot,
+             size_t parity)
+        : owner_(owner), version_(version), slot_(slot), parity_(parity) {}
+
+    const SharedTrie *owner_;
+    const Version *version_;
+    size_t slot_;
+    size_t parity_;
+  };
+
+  static constexpr size_t ReaderSlots = 64;
+
+  explicit SharedTrie(const std::vector<std::string> &items = {},
+                      CaseFolding folding = CaseFolding::None)
+      : folding_(folding), current_(make_version(items).release()) {}
+
+  SharedTrie(const SharedTrie &) = delete;
+  SharedTrie &operator=(const SharedTrie &) = delete;
+
+  // 此时不能还有 Snapshot。
+  ~SharedTrie() { delete current_.load(); }
+
+  Snapshot snapshot() const {
+    auto slot = thread_slot();
+    auto parity = static_cast<size_t>(epoch_.load() & 1);
+    slots_[slot].readers[parity].fetch_add(1);
+    return Snapshot(this, current_.load(), slot, parity);
+  }
+
+  // 在当前的关键字集合上先删除 erase 中的关键字，再加入 insert 中的，
+  // 构建新版本并替换当前版本。返回时旧版本已经释放。多个写者之间互斥，
+  // 不影响读者。调用的线程不能持有这个 SharedTrie 的 Snapshot，否则死锁。
+  void update(const std::vector<std::string> &insert,
+              const std::vector<std::string> &erase = {}) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    const auto &old = current_.load()->keywords;
+    auto removed = sorted_unique(erase);
+    std::vector<std::string> kept;
+    std::set_difference(old.begin(), old.end(), removed.begin(),
+                        removed.end(), std::back_inserter(kept));
+    auto added = sorted_unique(insert);
+    std::vector<std::string> keywords;
+    keywords.reserve(kept.size() + added.size());
+    std::set_union(kept.begin(), kept.end(), added.begin(), added.end(),
+                   std::back_inserter(keywords));
+
+    auto version = make_version(keywords);
+    std::unique_ptr<Version> retired(current_.exchange(version.release()));
+    synchronize();
+  }
+
+private:
+  struct Version {
+    std::vector<std::string> keywords;
+    Trie trie;
+  };
+
+  struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> readers[2] = {};
+  };
+
+  std::unique_ptr<Version>
+  make_version(const std::vector<std::string> &items) const {
+    auto keywords = sorted_unique(items);
+    // 已经有序，不区分大小写时 Trie 会按折叠后的关键字重新排序。
+    Trie trie(keywords, folding_);
+    return std::unique_ptr<Version>(
+        new Version{std::move(keywords), std::move(trie)});
+  }
+
+  static std::vector<std::string>
+  sorted_unique(std::vector<std::string> items) {
+    std::sort(items.begin(), items.end());
+    items.erase(std::unique(items.begin(), items.end()), items.end());
+    return items;
+  }
+
+  // 等待 synchronize 开始前已经进入的读者全部结束。
+  void synchronize() {
+    for (auto k = 0; k < 2; k++) {
+      auto parity = static_cast<size_t>(epoch_.fetch_add(1) & 1);
+      for (;;) {
+        uint64_t readers = 0;
+        for (const auto &slot : slots_) {
+          readers += slot.readers[parity].load();
+        }
+        if (!readers) { break; }
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  static size_t thread_slot() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t slot = next.fetch_add(1) % ReaderSlots;
+    return slot;
+  }
 
-  // TODO: Use unordered_map when heterogeneous lookup is supported in C++20
-  // std::unordered_map<std::string, Info> dic_;
-  std::map<std::string, Info, std::less<>> dic_;
+  CaseFolding folding_;
+  std::atomic<Version *> current_;
+  std::atomic<uint64_t> epoch_{0};
+  mutable std::array<ReaderSlot, ReaderSlots> slots_;
+  std::mutex writer_mutex_;
 };
 
 }  // namespace peg
@@ -0,0 +1,1630 @@
+// 自检测试：与标准库或朴素实现对照，随机输入使用固定的种子。
+//   make -C test
+#include <peg.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+using namespace peg;
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      if (++failures <= 20) {                                                  \
+        std::printf("%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond);   \
+        std::printf(__VA_ARGS__);                                              \
+        std::printf("\n");                                                     \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+template <typename T> static bool same_bits(T a, T b) {
+  return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+/*-----------------------------------------------------------------------------
+ *  codepoint_count
+ *---------------------------------------------------------------------------*/
+
+// 不是 10xxxxxx 的字节数。
+static size_t naive_count_lead_bytes(const std::string &s) {
+  size_t n = 0;
+  for (auto ch : s) {
+    n += (static_cast<uint8_t>(ch) & 0xC0) != 0x80;
+  }
+  return n;
+}
+
+static void check_codepoint_count(const std::string &s) {
+  using Kernel = size_t (*)(const char *, size_t);
+  std::vector<std::pair<const char *, Kernel>> kernels = {
+      {"count_lead_bytes_scalar", detail::count_lead_bytes_scalar},
+      {"codepoint_count", codepoint_count},
+  };
+#ifdef PEG_USE_X86_SIMD
+  auto level = detail::simd_level();
+  if (level >= detail::SimdLevel::SSE2) {
+    kernels.emplace_back("count_lead_bytes_sse2",
+                         detail::count_lead_bytes_sse2);
+  }
+  if (level >= detail::SimdLevel::AVX2) {
+    kernels.emplace_back("count_lead_bytes_avx2",
+                         detail::count_lead_bytes_avx2);
+  }
+  if (level >= detail::SimdLevel::AVX512) {
+    kernels.emplace_back("count_lead_bytes_avx512",
+                         detail::count_lead_bytes_avx512);
+  }
+#endif
+  auto expected = naive_count_lead_bytes(s);
+  for (const auto &[name, kernel] : kernels) {
+    auto got = kernel(s.data(), s.size());
+    CHECK(got == expected, "%s: %zu, expected %zu of %zu", name, got,
+          expected, s.size());
+  }
+}
+
+static void test_codepoint_count() {
+  // 非法的首字节曾使 codepoint_count 停滞不前，这里必须能够结束。
+  check_codepoint_count("\xFF");
+  check_codepoint_count("\x80");
+  check_codepoint_count("a\xFF\x80\xFF" "b\x80\x80");
+  check_codepoint_count(std::string(100, '\xFF') + std::string(100, '\x80'));
+  CHECK(codepoint_count("\xFF\x80\xFE\xC0", 4) == 3, "invalid lead bytes");
+
+  std::mt19937_64 rng(1);
+  for (auto iter = 0; iter < 20000; iter++) {
+    std::string s(rng() % 201, ' ');
+    auto ascii = rng() % 2;
+    for (auto &ch : s) {
+      ch = static_cast<char>(ascii && rng() % 2 ? rng() % 0x80 : rng());
+    }
+    check_codepoint_count(s);
+  }
+  // SSE2/AVX2 的字节累加器每 255 块归约一次。
+  for (auto len : {255 * 16 - 1, 255 * 16, 255 * 16 + 17, 255 * 32 + 33,
+                   255 * 32 * 3 + 5}) {
+    std::string s(len, ' ');
+    for (auto &ch : s) {
+      ch = static_cast<char>(rng());
+    }
+    check_codepoint_count(s);
+    check_codepoint_count(std::string(len, 'a'));
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  encode
+ *---------------------------------------------------------------------------*/
+
+// 各类码点都有，包括代理区、超过 U+10FFFF 的值以及 SIMD 内核异或
+// 0x80000000 后的边界。
+static char32_t random_codepoint(std::mt19937_64 &rng) {
+  static const char32_t edges[] = {
+      0,      0x7F,     0x80,     0x7FF,      0x800,      0xD7FF,
+      0xD800, 0xDBFF,   0xDC00,   0xDFFF,     0xE000,     0xFFFF,
+      0x10000, 0x10FFFF, 0x110000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF,
+  };
+  switch (rng() % 6) {
+    case 0: return static_cast<char32_t>(rng() % 0x80);
+    case 1: return static_cast<char32_t>(rng() % 0x800);
+    case 2: return static_cast<char32_t>(rng() % 0x10000);
+    case 3: return static_cast<char32_t>(rng() % 0x110000);
+    case 4: return edges[rng() % std::size(edges)];
+    default: return static_cast<char32_t>(rng());
+  }
+}
+
+static void check_encode(const std::u32string &s32) {
+  std::string expected;
+  for (auto cp : s32) {
+    expected += encode_codepoint(cp);
+  }
+
+  using Kernel = size_t (*)(const char32_t *, size_t);
+  std::vector<std::pair<const char *, Kernel>> kernels = {
+      {"encode_length_scalar", detail::encode_length_scalar},
+  };
+#ifdef PEG_USE_X86_SIMD
+  if (detail::simd_level() >= detail::SimdLevel::SSE2) {
+    kernels.emplace_back("encode_length_sse2", detail::encode_length_sse2);
+  }
+  if (detail::simd_level() >= detail::SimdLevel::AVX2) {
+    kernels.emplace_back("encode_length_avx2", detail::encode_length_avx2);
+  }
+#endif
+  for (const auto &[name, kernel] : kernels) {
+    auto got = kernel(s32.data(), s32.size());
+    CHECK(got == expected.size(), "%s: %zu, expected %zu of %zu", name, got,
+          expected.size(), s32.size());
+  }
+  CHECK(encode_length(s32) == expected.size(), "encode_length");
+  CHECK(encode(s32) == expected, "encode of %zu code points", s32.size());
+}
+
+// 空间不足时只写入能完整容纳的码点，并且不写 buff[len] 及之后的字节。
+static void check_encode_into(const std::u32string &s32) {
+  std::string expected;
+  std::vector<size_t> ends{0};  // 前 k 个码点编码后的长度
+  for (auto cp : s32) {
+    expected += encode_codepoint(cp);
+    ends.push_back(expected.size());
+  }
+  for (size_t len = 0; len <= expected.size() + 4; len++) {
+    std::vector<char> buff(len + 8, '#');
+    auto pos = encode_into(s32, buff.data(), len);
+    auto fits = *std::prev(std::upper_bound(ends.begin(), ends.end(), len));
+    CHECK(pos == fits &&
+              std::string(buff.data(), pos) == expected.substr(0, pos),
+          "encode_into with %zu bytes wrote %zu, expected %zu", len, pos, fits);
+    CHECK(std::all_of(buff.begin() + static_cast<std::ptrdiff_t>(len),
+                      buff.end(), [](char c) { return c == '#'; }),
+          "encode_into wrote past %zu bytes", len);
+  }
+}
+
+static void test_encode() {
+  // 代理区和超过 U+10FFFF 的码点被拒绝。
+  for (auto cp : {U'\xD800', U'\xDFFF', U'\x110000', U'\xFFFFFFFF'}) {
+    char buff[4];
+    CHECK(!encode_codepoint(cp, buff) && !encode_length(std::u32string(1, cp)),
+          "U+%04X is encoded", static_cast<unsigned>(cp));
+  }
+  CHECK(encode(U"a\u00E9\u4E00\U0001F600") ==
+            "a\xC3\xA9\xE4\xB8\x80\xF0\x9F\x98\x80",
+        "encode");
+  CHECK(encode(std::u32string{0x41, 0xD800, 0x110000, 0x42}) == "AB",
+        "invalid code points are dropped");
+
+  std::mt19937_64 rng(4);
+  for (auto iter = 0; iter < 5000; iter++) {
+    std::u32string s32(rng() % 100, U' ');
+    for (auto &cp : s32) {
+      cp = random_codepoint(rng);
+    }
+    check_encode(s32);
+    if (iter < 500) { check_encode_into(s32); }
+  }
+  // SSE2 和 AVX2 的 32 位累加器每 65536 轮归约一次。
+  std::u32string long32(65536 * 8 + 13, U' ');
+  for (auto &cp : long32) {
+    cp = random_codepoint(rng);
+  }
+  check_encode(long32);
+  check_encode(std::u32string(65536 * 8 + 13, 0x10FFFF));
+}
+
+/*-----------------------------------------------------------------------------
+ *  validate_utf8
+ *---------------------------------------------------------------------------*/
+
+// 逐个码点调用 decode_codepoint_strict，返回第一个非法序列的偏移。
+static size_t naive_validate_utf8(const std::string &s) {
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t bytes;
+    char32_t cp;
+    if (!decode_codepoint_strict(s.data() + i, s.size() - i, bytes, cp)) {
+      return i;
+    }
+    i += bytes;
+  }
+  return s.size();
+}
+
+#ifdef PEG_USE_X86_SIMD
+// SIMD 内核只检查完整的块，返回的块偏移不能越过出错的块，也不能在出错
+// 之前停下；由 validate_utf8_resume 接着检查后得到与朴素实现相同的偏移。
+using Utf8Kernel = size_t (*)(const char *, size_t);
+
+static void check_utf8_kernel(const char *name, Utf8Kernel kernel,
+                              size_t block, const std::string &s,
+                              size_t expected) {
+  auto l = s.size();
+  auto k = kernel(s.data(), l);
+  auto first = std::min(expected / block, l / block) * block;
+  auto last = std::min((expected + 3) / block, l / block) * block;
+  CHECK(k % block == 0 && first <= k && k <= last,
+        "%s stopped at %zu, first error at %zu of %zu", name, k, expected, l);
+  auto got = detail::validate_utf8_resume(s.data(), l, k);
+  CHECK(got == expected, "%s: %zu, expected %zu of %zu", name, got, expected,
+        l);
+}
+#endif
+
+static void check_utf8(const std::string &s) {
+  auto expected = naive_validate_utf8(s);
+  auto got = detail::validate_utf8_scalar(s.data(), s.size(), 0);
+  CHECK(got == expected, "validate_utf8_scalar: %zu, expected %zu of %zu",
+        got, expected, s.size());
+  got = validate_utf8(s.data(), s.size());
+  CHECK(got == expected, "validate_utf8: %zu, expected %zu of %zu", got,
+        expected, s.size());
+#ifdef PEG_USE_X86_SIMD
+  if (detail::simd_level() >= detail::SimdLevel::SSSE3) {
+    check_utf8_kernel("validate_utf8_ssse3", detail::validate_utf8_ssse3, 16,
+                      s, expected);
+  }
+  if (detail::simd_level() >= detail::SimdLevel::AVX2) {
+    check_utf8_kernel("validate_utf8_avx2", detail::validate_utf8_avx2, 32, s,
+                      expected);
+  }
+#endif
+}
+
+static const char *const Utf8Valid[] = {
+    "a", "\x7F", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80",
+    "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+    "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF", "\xF3\xBF\xBF\xBF",
+};
+
+// overlong、代理区、超过 U+10FFFF、非法的首字节、孤立的 continuation
+// 字节以及被截断的序列。
+static const char *const Utf8Invalid[] = {
+    "\xC0\x80",         "\xC1\xBF",         "\xE0\x80\x80",
+    "\xE0\x9F\xBF",     "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+    "\xED\xA0\x80",     "\xED\xBF\xBF",     "\xF4\x90\x80\x80",
+    "\xF4\xBF\xBF\xBF", "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80",
+    "\xFE",             "\xFF",             "\x80",
+    "\xBF\xBF",         "\xC2",             "\xE2\x82",
+    "\xF0\x9F\x98",     "\xC2\x41",         "\xE2\x28\xA1",
+    "\xF0\x9F\x28\x80",
+};
+
+static void test_validate_utf8() {
+  std::mt19937_64 rng(2);
+  auto random_valid = [&](size_t len) {
+    std::string s;
+    while (s.size() < len) {
+      s += rng() % 2 ? std::string(rng() % 20, 'x')
+                     : std::string(Utf8Valid[rng() % std::size(Utf8Valid)]);
+    }
+    return s;
+  };
+
+  // 每个片段都放在 16/32/64 字节的块边界前后，之后的内容足够构成下一块。
+  for (auto fragment : Utf8Invalid) {
+    for (auto boundary : {16, 32, 64, 128}) {
+      for (auto shift = -4; shift <= 4; shift++) {
+        for (auto tail : {0, 1, 70}) {
+          auto s = std::string(boundary + shift, 'a') + fragment +
+                   random_valid(tail);
+          check_utf8(s);
+          // 多字节序列开头也能使前一块的末尾字节成为首字节。
+          check_utf8(random_valid(boundary + shift) + fragment +
+                     random_valid(tail));
+        }
+      }
+    }
+  }
+  for (auto fragment : Utf8Valid) {
+    for (auto boundary : {16, 32, 64}) {
+      for (auto shift = -4; shift <= 1; shift++) {
+        check_utf8(std::string(boundary + shift, 'a') + fragment +
+                   std::string(70, 'b'));
+      }
+    }
+  }
+
+  // 合法文本中替换或插入随机字节，以及完全随机的字节。
+  for (auto iter = 0; iter < 20000; iter++) {
+    auto s = random_valid(rng() % 300);
+    switch (rng() % 4) {
+      case 0: break;
+      case 1:
+        if (!s.empty()) { s[rng() % s.size()] = static_cast<char>(rng()); }
+        break;
+      case 2:
+        s.insert(rng() % (s.size() + 1), 1,
+                 static_cast<char>(0x80 + rng() % 128));
+        break;
+      default:
+        for (auto &ch : s) {
+          ch = static_cast<char>(rng());
+        }
+    }
+    check_utf8(s);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  LineIndex
+ *---------------------------------------------------------------------------*/
+
+// 每个偏移的（行，列）：行号是之前的换行符数加 1，列号是行首到该偏移
+// 之间不是 continuation 字节的字节数加 1。
+static std::vector<std::pair<size_t, size_t>>
+naive_line_info(const std::string &s) {
+  std::vector<std::pair<size_t, size_t>> info{{1, 1}};
+  for (auto ch : s) {
+    auto [line, col] = info.back();
+    if (ch == '\n') {
+      info.emplace_back(line + 1, 1);
+    } else {
+      auto lead = (static_cast<uint8_t>(ch) & 0xC0) != 0x80;
+      info.emplace_back(line, col + lead);
+    }
+  }
+  return info;
+}
+
+static void test_line_index() {
+  const char *const pieces[] = {"a", "bc", "\n", "\n\n", "\xC3\xA9",
+                                "\xE4\xB8\x80", "\xF0\x9F\x98\x80", "\xFF",
+                                "\x80", "\r\n"};
+  std::mt19937_64 rng(6);
+  for (auto iter = 0; iter < 300; iter++) {
+    // 有的文本换行很多，有的只有几行很长的行。
+    auto newlines = iter % 3 != 0;
+    std::string s;
+    for (auto n = rng() % 400; n > 0; n--) {
+      auto p = pieces[rng() % std::size(pieces)];
+      if (!newlines && std::strchr(p, '\n') && rng() % 20) { continue; }
+      s += p;
+    }
+
+    std::vector<size_t> expected_starts{0};
+    for (size_t i = 0; i < s.size(); i++) {
+      if (s[i] == '\n') { expected_starts.push_back(i + 1); }
+    }
+    auto expected_info = naive_line_info(s);
+    for (auto interval : {0, 1, 3, 16, 64, 1000}) {
+      LineIndex index(s, static_cast<size_t>(interval));
+      CHECK(index.line_count() == expected_starts.size(),
+            "%zu lines, expected %zu", index.line_count(),
+            expected_starts.size());
+      for (size_t l = 1; l <= expected_starts.size(); l++) {
+        CHECK(index.line_start(l) == expected_starts[l - 1],
+              "line_start(%zu)", l);
+      }
+      // 超过末尾的偏移按末尾计算。
+      for (size_t offset = 0; offset <= s.size() + 2; offset++) {
+        auto expected = expected_info[std::min(offset, s.size())];
+        auto got = index.line_info(offset);
+        CHECK(got == expected,
+              "line_info(%zu) with interval %d is (%zu, %zu), expected "
+              "(%zu, %zu)",
+              offset, interval, got.first, got.second, expected.first,
+              expected.second);
+      }
+      CHECK(index.line_info(s.data() + s.size()) == expected_info.back(),
+            "line_info at the end");
+    }
+
+#ifdef PEG_USE_X86_SIMD
+    // 直接比较各个换行符扫描内核。
+    std::vector<size_t> sse2{0}, avx2{0};
+    if (detail::simd_level() >= detail::SimdLevel::SSE2) {
+      detail::scan_newlines_sse2(s.data(), s.size(), sse2, 0);
+      CHECK(sse2 == expected_starts, "scan_newlines_sse2");
+    }
+    if (detail::simd_level() >= detail::SimdLevel::AVX2) {
+      detail::scan_newlines_avx2(s.data(), s.size(), avx2, 0);
+      CHECK(avx2 == expected_starts, "scan_newlines_avx2");
+    }
+#endif
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  CharacterSet
+ *---------------------------------------------------------------------------*/
+
+static bool naive_contains(const std::vector<CharacterSet::Range> &ranges,
+                           bool negated, char32_t cp) {
+  auto found = false;
+  for (const auto &[lo, hi] : ranges) {
+    found |= lo <= cp && cp <= hi;
+  }
+  return found != negated;
+}
+
+static void test_character_set() {
+  std::mt19937_64 rng(8);
+  // 区间落在 Latin-1、BMP 和辅助平面，有的跨越 U+00FF/U+0100 或
+  // U+FFFF/U+10000，有的首尾颠倒（应当被忽略）。
+  auto random_cp = [&]() -> char32_t {
+    switch (rng() % 5) {
+      case 0: return static_cast<char32_t>(rng() % 0x100);
+      case 1: return static_cast<char32_t>(0xF0 + rng() % 0x20);
+      case 2: return static_cast<char32_t>(rng() % 0x10000);
+      case 3: return static_cast<char32_t>(0xFFF0 + rng() % 0x20);
+      default: return static_cast<char32_t>(rng() % 0x110000);
+    }
+  };
+  for (auto iter = 0; iter < 2000; iter++) {
+    std::vector<CharacterSet::Range> ranges(rng() % 12);
+    for (auto &[lo, hi] : ranges) {
+      lo = random_cp();
+      hi = rng() % 3 ? lo + static_cast<char32_t>(rng() % 300) : random_cp();
+      hi = std::min<char32_t>(hi, 0x10FFFF);
+    }
+    auto negated = rng() % 2 == 0;
+    CharacterSet set(ranges, negated);
+
+    std::vector<char32_t> probes = {0, 0x7F, 0x80, 0xFF, 0x100, 0xFFFF,
+                                    0x10000, 0x10FFFF};
+    for (const auto &[lo, hi] : ranges) {
+      for (auto cp : {lo, hi}) {
+        probes.push_back(cp - 1);
+        probes.push_back(cp);
+        probes.push_back(cp + 1);
+      }
+    }
+    for (auto k = 0; k < 200; k++) {
+      probes.push_back(random_cp());
+    }
+    for (auto cp : probes) {
+      if (cp > 0x10FFFF) { continue; }
+      auto expected = naive_contains(ranges, negated, cp);
+      CHECK(set.contains(cp) == expected, "contains(U+%04X) with %zu ranges%s",
+            static_cast<unsigned>(cp), ranges.size(),
+            negated ? ", negated" : "");
+      // match 解码第一个码点，不属于集合时返回 0。
+      char buff[4];
+      auto len = encode_codepoint(cp, buff);
+      if (len) {
+        CHECK(set.match(buff, len) == (expected ? len : 0),
+              "match(U+%04X)", static_cast<unsigned>(cp));
+      }
+    }
+  }
+
+  // [a-zα-ω一-鿿😀-🙏]、它的补集、颠倒的区间和空集合。
+  CharacterSet set({{'a', 'z'}, {0x3B1, 0x3C9}, {0x4E00, 0x9FFF},
+                    {0x1F600, 0x1F64F}});
+  CHECK(set.match("q", 1) == 1 && set.match("Q", 1) == 0, "ASCII");
+  CHECK(set.match("\xCE\xB1", 2) == 2, "U+03B1");
+  CHECK(set.match("\xE4\xB8\x80", 3) == 3, "U+4E00");
+  CHECK(set.match("\xF0\x9F\x98\x80", 4) == 4, "U+1F600");
+  CHECK(set.match("\xF0\x9F\x99\x90", 4) == 0, "U+1F650");
+  CHECK(set.match("\xE4\xB8", 2) == 0, "truncated sequence");
+  CHECK(set.match("", 0) == 0, "empty input");
+  CharacterSet negated({{'a', 'z'}, {0x1F600, 0x1F64F}}, true);
+  CHECK(!negated.contains('q') && negated.contains('Q') &&
+            !negated.contains(0x1F600) && negated.contains(0x1F650) &&
+            negated.contains(0x10FFFF),
+        "negated set");
+  CharacterSet reversed({{'z', 'a'}, {0x1F64F, 0x1F600}});
+  CHECK(!reversed.contains('q') && !reversed.contains(0x1F610),
+        "reversed ranges are ignored");
+  CharacterSet empty;
+  CHECK(!empty.contains(0) && !empty.contains(0x10FFFF), "empty set");
+}
+
+/*-----------------------------------------------------------------------------
+ *  resolve_escape_sequence
+ *---------------------------------------------------------------------------*/
+
+struct EscapeCase {
+  const char *input;
+  const char *expected;  // nullptr 表示应当抛出 std::runtime_error
+  size_t expected_size = std::string::npos;  // 含有 '\0' 时给出
+};
+
+static void check_escapes(const char *name, const EscapeDialect &dialect,
+                          std::initializer_list<EscapeCase> cases) {
+  for (const auto &c : cases) {
+    std::string in(c.input);
+    std::string got;
+    auto threw = false;
+    try {
+      got = resolve_escape_sequence(in.data(), in.size(), dialect);
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    if (!c.expected) {
+      CHECK(threw, "%s: \"%s\" should be rejected", name, c.input);
+      continue;
+    }
+    auto expected = c.expected_size == std::string::npos
+                        ? std::string(c.expected)
+                        : std::string(c.expected, c.expected_size);
+    CHECK(!threw && got == expected, "%s: \"%s\" is %s\"%s\"", name, c.input,
+          threw ? "rejected, not " : "", got.c_str());
+  }
+}
+
+static void test_resolve_escape_sequence() {
+  // 本库语法：\u 的代理对合并，数值都编码为 UTF-8。
+  check_escapes("PegEscapes", PegEscapes,
+                {
+                    {"a\\nb\\t", "a\nb\t"},
+                    {"\\[\\]\\'\\\"\\\\", "[]'\"\\"},
+                    {"\\x41\\x4", "A\x04"},
+                    {"\\xFF", "\xC3\xBF"},
+                    {"\\x414", "A4"},
+                    {"\\u00e9", "\xC3\xA9"},
+                    {"\\uD83D\\uDE00", "\xF0\x9F\x98\x80"},
+                    {"\\U0001F600", "\xF0\x9F\x98\x80"},
+                    {"\\101\\0", "A\0", 2},
+                    {"\\377", "\xC3\xBF"},
+                    {"\\x", nullptr},
+                    {"\\xg", nullptr},
+                    {"\\uD83D", nullptr},
+                    {"\\uDE00", nullptr},
+                    {"\\U110000", nullptr},
+                    {"\\400", nullptr},
+                    {"\\777", nullptr},
+                    {"\\8", nullptr},
+                    {"\\9", nullptr},
+                    {"\\q", nullptr},
+                    {"\\a", nullptr},
+                    {"\\-", nullptr},
+                    {"\\^", nullptr},
+                    {"abc\\", nullptr},
+                });
+  // JSON：\u 必须正好 4 位，代理对必须成对出现。
+  check_escapes("JsonEscapes", JsonEscapes,
+                {
+                    {"\\\"\\\\\\/\\b\\f\\n\\r\\t", "\"\\/\b\f\n\r\t"},
+                    {"\\u00e9", "\xC3\xA9"},
+                    {"\\u00E9x", "\xC3\xA9x"},
+                    {"\\u12345", "\xE1\x88\xB4" "5"},
+                    {"\\u0000", "\0", 1},
+                    {"\\uD83D\\uDE00", "\xF0\x9F\x98\x80"},
+                    {"\\ud83d\\ude00!", "\xF0\x9F\x98\x80!"},
+                    {"\\u00e", nullptr},
+                    {"\\u", nullptr},
+                    {"\\uD83D", nullptr},
+                    {"\\uD83D\\u0041", nullptr},
+                    {"\\uD83D\\uDE0", nullptr},
+                    {"\\uDE00\\uD83D", nullptr},
+                    {"\\x41", nullptr},
+                    {"\\'", nullptr},
+                    {"\\0", nullptr},
+                    {"\\a", nullptr},
+                });
+  // C：\x 和八进制转义是原始字节，\u 和 \U 必须是 4 位和 8 位。
+  check_escapes("CEscapes", CEscapes,
+                {
+                    {"\\a\\b\\f\\n\\r\\t\\v\\?", "\a\b\f\n\r\t\v?"},
+                    {"\\xFF", "\xFF"},
+                    {"\\xff\\x7F", "\xFF\x7F"},
+                    {"\\x0041", "A"},
+                    {"\\377\\1", "\xFF\x01"},
+                    {"\\0", "\0", 1},
+                    {"\\1234", "S4"},
+                    {"\\u00e9", "\xC3\xA9"},
+                    {"\\U0001F600", "\xF0\x9F\x98\x80"},
+                    {"\\x100", nullptr},
+                    {"\\x", nullptr},
+                    {"\\400", nullptr},
+                    {"\\8", nullptr},
+                    {"\\u00e", nullptr},
+                    {"\\U0001F60", nullptr},
+                    {"\\uD800", nullptr},
+                    {"\\q", nullptr},
+                });
+  // Python：未知的转义原样保留，反斜杠加换行被跳过，\x 必须正好 2 位。
+  check_escapes("PythonEscapes", PythonEscapes,
+                {
+                    {"\\q\\8\\[", "\\q\\8\\["},
+                    {"a\\\nb", "ab"},
+                    {"\\a\\'\\\\", "\a'\\"},
+                    {"\\x41", "A"},
+                    {"\\xFF", "\xC3\xBF"},
+                    {"\\101", "A"},
+                    {"\\777", "\xC7\xBF"},
+                    {"\\u00e9", "\xC3\xA9"},
+                    {"\\U0001F600", "\xF0\x9F\x98\x80"},
+                    {"\\x4", nullptr},
+                    {"\\x4g", nullptr},
+                    {"\\u00e", nullptr},
+                    {"\\U0001F60", nullptr},
+                    {"\\uD800", nullptr},
+                    {"\\N{DASH}", nullptr},
+                    {"\\", nullptr},
+                });
+
+  // 没有反斜杠时借用输入本身，否则持有解析后的字符串。
+  std::string plain = "no escapes here";
+  auto borrowed = resolve_escape_sequence_view(plain.data(), plain.size());
+  CHECK(!borrowed.owned() && borrowed.data() == plain.data() &&
+            borrowed.view() == plain,
+        "input without backslashes is borrowed");
+  auto empty = resolve_escape_sequence_view(plain.data(), 0);
+  CHECK(!empty.owned() && empty.empty(), "empty input is borrowed");
+  std::string escaped = "tab\\t";
+  auto owned = resolve_escape_sequence_view(escaped.data(), escaped.size());
+  CHECK(owned.owned() && owned.view() == "tab\t", "escaped input is owned");
+  std::string unknown = "\\q";
+  auto kept = resolve_escape_sequence_view(unknown.data(), unknown.size(),
+                                           PythonEscapes);
+  CHECK(kept.owned() && kept.view() == unknown, "Python keeps \\q");
+  CHECK(std::move(owned).str() == "tab\t", "owned string is moved out");
+  CowString literal("literal");
+  CHECK(!literal.owned() && literal.view() == "literal", "literal is borrowed");
+}
+
+/*-----------------------------------------------------------------------------
+ *  parse_float
+ *---------------------------------------------------------------------------*/
+
+// 随机的十进制浮点数：位数和指数覆盖快速路径、Eisel-Lemire 和精确计算。
+static std::string random_decimal(std::mt19937_64 &rng) {
+  std::string s;
+  if (rng() % 4 == 0) { s += rng() % 2 ? '-' : '+'; }
+  auto digits = 1 + rng() % (rng() % 8 == 0 ? 800 : 20);
+  auto point = rng() % (digits + 1);
+  for (size_t i = 0; i < digits; i++) {
+    if (i == point && i) { s += '.'; }
+    s += static_cast<char>('0' + rng() % 10);
+  }
+  if (rng() % 2) {
+    s += rng() % 2 ? 'e' : 'E';
+    s += std::to_string(static_cast<int>(rng() % 700) - 350);
+  }
+  return s;
+}
+
+static void test_parse_float() {
+  std::vector<std::string> inputs = {
+      "0",
+      "-0",
+      "1",
+      "0.1",
+      "1e23",
+      "9007199254740993",
+      "9007199254740992.5",
+      "2.2250738585072011e-308",
+      "2.2250738585072014e-308",
+      "4.9406564584124654e-324",
+      "2.4703282292062327e-324",
+      "2.4703282292062328e-324",
+      "1.7976931348623157e308",
+      "1.7976931348623159e308",
+      "3.4028235e38",
+      "3.4028236e38",
+      "1.4e-45",
+      "7e-46",
+      "1e-400",
+      "1e400",
+      "inf",
+      "-Infinity",
+      "123abc",
+      "1.5e",
+      ".5",
+      "5.",
+  };
+  std::mt19937_64 rng(14);
+  for (auto i = 0; i < 200000; i++) {
+    inputs.push_back(random_decimal(rng));
+  }
+  for (const auto &s : inputs) {
+    char *end;
+    auto d = std::strtod(s.c_str(), &end);
+    auto rd = parse_float<double>(s);
+    CHECK(same_bits(rd.value, d), "parse_float<double>(\"%s\")", s.c_str());
+    CHECK(rd.consumed == static_cast<size_t>(end - s.c_str()),
+          "parse_float<double>(\"%s\") consumed %zu", s.c_str(), rd.consumed);
+    auto f = std::strtof(s.c_str(), &end);
+    auto rf = parse_float<float>(s);
+    CHECK(same_bits(rf.value, f), "parse_float<float>(\"%s\")", s.c_str());
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  parse_number
+ *---------------------------------------------------------------------------*/
+
+// 没有前缀、正号和分隔符的十进制整数与 std::from_chars 相同，只是超出
+// 范围时 value 为 0。
+template <typename T> static void check_from_chars(const std::string &s) {
+  auto r = parse_number<T>(s, 0);
+  T value = 0;
+  auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec == std::errc::result_out_of_range) { value = 0; }
+  auto consumed = ec == std::errc::invalid_argument
+                      ? 0
+                      : static_cast<size_t>(ptr - s.data());
+  CHECK(r.ec == ec && r.value == value && r.consumed == consumed,
+        "parse_number<%zu-byte>(\"%s\")", sizeof(T), s.c_str());
+}
+
+template <typename T>
+static void check_number(const char *s, T value, std::errc ec,
+                         size_t consumed, char separator = '_') {
+  auto r = parse_number<T>(s, separator);
+  CHECK(r.value == value && r.ec == ec && r.consumed == consumed,
+        "parse_number(\"%s\") is %lld, ec %d, consumed %zu", s,
+        static_cast<long long>(r.value), static_cast<int>(r.ec), r.consumed);
+}
+
+static void test_parse_number() {
+  std::mt19937_64 rng(15);
+  const char *const suffixes[] = {"", "", " ", ".5", "-1", ",", "e3", "+"};
+  for (auto iter = 0; iter < 100000; iter++) {
+    std::string s = rng() % 3 ? "" : "-";
+    auto digits = 1 + rng() % 22;
+    for (size_t i = 0; i < digits; i++) {
+      // 多数是不带前导零的数，偶尔以 0 开头或全是 9，覆盖各类型的边界。
+      s += i == 0 && rng() % 8 ? '1' + rng() % 9
+           : rng() % 4 == 0    ? '9'
+                               : '0' + rng() % 10;
+    }
+    s += suffixes[rng() % std::size(suffixes)];
+    check_from_chars<int8_t>(s);
+    check_from_chars<uint8_t>(s);
+    check_from_chars<int16_t>(s);
+    check_from_chars<int>(s);
+    check_from_chars<unsigned>(s);
+    check_from_chars<long long>(s);
+    check_from_chars<unsigned long long>(s);
+  }
+
+  const auto ok = std::errc{};
+  const auto invalid = std::errc::invalid_argument;
+  const auto range = std::errc::result_out_of_range;
+  check_number<int>("0x1F", 31, ok, 4);
+  check_number<int>("0X1f", 31, ok, 4);
+  check_number<int>("0o17", 15, ok, 4);
+  check_number<int>("0O8", 0, ok, 1);
+  check_number<int>("0b101", 5, ok, 5);
+  check_number<int>("0B2", 0, ok, 1);
+  check_number<int>("-0x10", -16, ok, 5);
+  check_number<int>("+42", 42, ok, 3);
+  // 前缀后面没有相应进制的数字时只解析 "0"。
+  check_number<int>("0x", 0, ok, 1);
+  check_number<int>("0xg", 0, ok, 1);
+  check_number<int>("0x_1", 0, ok, 1);
+  check_number<int>("0b", 0, ok, 1);
+  check_number<int>("", 0, invalid, 0);
+  check_number<int>("-", 0, invalid, 0);
+  check_number<int>("+-1", 0, invalid, 0);
+  check_number<int>("x1", 0, invalid, 0);
+  check_number<unsigned>("-1", 0, invalid, 0);
+  check_number<unsigned>("-0", 0, invalid, 0);
+  // 分隔符只能出现在两个数字之间，而且只能有一个。
+  check_number<int>("1_000_000", 1000000, ok, 9);
+  check_number<int>("0xFF_FF", 0xFFFF, ok, 7);
+  check_number<int>("0b1_0", 2, ok, 5);
+  check_number<int>("_1", 0, invalid, 0);
+  check_number<int>("1_", 1, ok, 1);
+  check_number<int>("1__0", 1, ok, 1);
+  check_number<int>("12_3456789_0", 1234567890, ok, 12);
+  check_number<int>("1'000", 1000, ok, 5, '\'');
+  check_number<int>("1_000", 1, ok, 1, 0);
+  // 边界和超出范围：value 为 0，consumed 包括整个数字串。
+  check_number<long long>("-9223372036854775808",
+                          std::numeric_limits<long long>::min(), ok, 20);
+  check_number<long long>("-0x8000000000000000",
+                          std::numeric_limits<long long>::min(), ok, 19);
+  check_number<long long>("9223372036854775807",
+                          std::numeric_limits<long long>::max(), ok, 19);
+  check_number<long long>("9223372036854775808", 0, range, 19);
+  check_number<long long>("-9223372036854775809", 0, range, 20);
+  check_number<unsigned long long>("18446744073709551615",
+                                   ~0ULL, ok, 20);
+  check_number<unsigned long long>("18446744073709551616", 0, range, 20);
+  check_number<unsigned long long>("0xFFFF_FFFF_FFFF_FFFF", ~0ULL, ok, 21);
+  check_number<unsigned long long>("0x1_0000_0000_0000_0000", 0, range, 23);
+  check_number<long long>("123456789012345678901234567890", 0, range, 30);
+  check_number<int8_t>("-128", -128, ok, 4);
+  check_number<int8_t>("128", 0, range, 3);
+  check_number<int8_t>("-129", 0, range, 4);
+  check_number<uint8_t>("255", 255, ok, 3);
+  check_number<uint8_t>("0x100", 0, range, 5);
+  check_number<int>("2147483648", 0, range, 10);
+  check_number<unsigned>("4294967295", 4294967295u, ok, 10);
+  check_number<unsigned>("4294967296", 0, range, 10);
+}
+
+/*-----------------------------------------------------------------------------
+ *  parse_numbers
+ *---------------------------------------------------------------------------*/
+
+// 按 parse_numbers 的约定逐个调用 parse_number：没有用完整个 token 也算
+// 失败，失败时值为 0。
+template <typename T>
+static void check_parse_numbers(const std::vector<std::string> &tokens) {
+  auto n = tokens.size();
+  std::vector<std::string_view> views(tokens.begin(), tokens.end());
+  std::string buffer;
+  std::vector<size_t> offsets{0};
+  for (const auto &t : tokens) {
+    buffer += t;
+    offsets.push_back(buffer.size());
+  }
+  std::vector<T> expected(n);
+  std::vector<std::errc> expected_errors(n);
+  size_t expected_failures = 0;
+  for (size_t k = 0; k < n; k++) {
+    auto r = parse_number<T>(tokens[k]);
+    auto ec = r.ec == std::errc{} && r.consumed != tokens[k].size()
+                  ? std::errc::invalid_argument
+                  : r.ec;
+    expected[k] = ec == std::errc{} ? r.value : T(0);
+    expected_errors[k] = ec;
+    expected_failures += ec != std::errc{};
+  }
+
+  for (auto threads : {1, 4}) {
+    std::vector<T> out(n, T(1));
+    std::vector<std::errc> errors(n);
+    auto failed =
+        parse_numbers(views.data(), n, out.data(), errors.data(), threads);
+    CHECK(failed == expected_failures, "%zu failures, expected %zu", failed,
+          expected_failures);
+    for (size_t k = 0; k < n; k++) {
+      CHECK(out[k] == expected[k] && errors[k] == expected_errors[k],
+            "parse_numbers<%zu-byte>(\"%s\") with %d threads", sizeof(T),
+            tokens[k].c_str(), threads);
+    }
+    std::fill(out.begin(), out.end(), T(1));
+    failed = parse_numbers(buffer.data(), offsets.data(), n, out.data(),
+                           nullptr, threads);
+    CHECK(failed == expected_failures && out == expected,
+          "parse_numbers with offsets and %d threads", threads);
+  }
+}
+
+static void test_parse_numbers() {
+  std::mt19937_64 rng(16);
+  auto digits = [&](size_t len) {
+    std::string s(len, '0');
+    for (auto &ch : s) {
+      ch = static_cast<char>('0' + rng() % 10);
+    }
+    return s;
+  };
+  const char *const signs[] = {"", "-", "+"};
+  // 混入 '0' - 1、'9' + 1、分隔符和高位为 1 的字节。
+  const char bad[] = {'/', ':', ' ', 'a', '_', '.', '\0', '\x80', '\xB0'};
+
+  std::vector<std::string> tokens = {
+      "",
+      "-",
+      "+",
+      "0",
+      "-0",
+      "4294967295",
+      "4294967296",
+      "-2147483648",
+      "2147483647",
+      "9999999999999999",
+      "10000000000000000",
+      "9223372036854775807",
+      "9223372036854775808",
+      "-9223372036854775808",
+      "-9223372036854775809",
+      "18446744073709551616",
+      "0x7FFF_FFFF",
+      "0b1010",
+      "1_000",
+  };
+  // 16 位上下的数字串，以及每个位置换成非数字字节的情形。
+  for (size_t len = 1; len <= 18; len++) {
+    for (auto sign : signs) {
+      auto s = digits(len);
+      tokens.push_back(sign + s);
+      for (size_t pos = 0; pos < len; pos++) {
+        auto t = s;
+        t[pos] = bad[rng() % sizeof(bad)];
+        tokens.push_back(sign + t);
+      }
+    }
+  }
+  // 足够多的 token 使 4 个线程都分到一段。
+  while (tokens.size() < 4 * 65536 + 123) {
+    auto len = 1 + rng() % 20;
+    auto t = signs[rng() % 3] + digits(len);
+    if (rng() % 8 == 0) {
+      t[rng() % t.size()] = bad[rng() % sizeof(bad)];
+    }
+    tokens.push_back(t);
+  }
+  check_parse_numbers<long long>(tokens);
+  check_parse_numbers<unsigned>(tokens);
+
+  // 两个 Decimal16 内核与逐位计算的结果相同。
+  for (auto iter = 0; iter < 100000; iter++) {
+    auto s = digits(1 + rng() % 16);
+    if (rng() % 2) { s[rng() % s.size()] = bad[rng() % sizeof(bad)]; }
+    auto valid = s.find_first_not_of("0123456789") == std::string::npos;
+    uint64_t expected = 0;
+    for (auto ch : s) {
+      expected = expected * 10 + static_cast<uint64_t>(ch - '0');
+    }
+    uint64_t v = 0;
+    auto r = detail::parse_decimal16_scalar(s.data(), s.size(), v);
+    CHECK(r == valid && (!valid || v == expected),
+          "parse_decimal16_scalar(\"%s\")", s.c_str());
+#ifdef PEG_USE_X86_SIMD
+    if (detail::simd_level() >= detail::SimdLevel::SSSE3) {
+      r = detail::parse_decimal16_ssse3(s.data(), s.size(), v);
+      CHECK(r == valid && (!valid || v == expected),
+            "parse_decimal16_ssse3(\"%s\")", s.c_str());
+    }
+#endif
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  format_float
+ *---------------------------------------------------------------------------*/
+
+// 有效数字的个数。
+static int significant_digits(const std::string &s) {
+  auto mantissa = s.substr(0, s.find('e'));
+  auto first = mantissa.find_first_of("123456789");
+  auto last = mantissa.find_last_of("123456789");
+  auto n = 0;
+  for (auto i = first; i <= last; i++) {
+    n += mantissa[i] != '.';
+  }
+  return n;
+}
+
+// 随机的位模式覆盖所有的指数，包括次正规数。结果必须能解析回原值，而且
+// 少一位有效数字时最接近的十进制数就不能解析回原值。
+template <typename T, typename Bits>
+static void test_format_float_random(std::mt19937_64 &rng, int count) {
+  for (auto i = 0; i < count; i++) {
+    auto bits = static_cast<Bits>(rng());
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    if (!std::isfinite(value) || value == 0) { continue; }
+    auto s = format_float(value);
+    CHECK(s.size() < FloatFormatMaxLength, "%s", s.c_str());
+    auto r = parse_float<T>(s);
+    CHECK(same_bits(r.value, value) && r.consumed == s.size(),
+          "format_float -> \"%s\" does not round-trip", s.c_str());
+    auto digits = significant_digits(s);
+    if (digits > 1) {
+      char shorter[64];
+      std::snprintf(shorter, sizeof(shorter), "%.*e", digits - 2,
+                    static_cast<double>(value));
+      CHECK(!same_bits(parse_float<T>(shorter).value, value),
+            "\"%s\" is not the shortest, \"%s\" also round-trips", s.c_str(),
+            shorter);
+    }
+  }
+}
+
+template <typename T>
+static void check_format(T value, const std::string &expected) {
+  auto s = format_float(value);
+  CHECK(s == expected, "format_float(%.17g) is \"%s\", expected \"%s\"",
+        static_cast<double>(value), s.c_str(), expected.c_str());
+}
+
+static void test_format_float() {
+  check_format(0.1, "0.1");
+  check_format(100.0, "100");
+  check_format(-2.5, "-2.5");
+  check_format(1e21, "1e+21");
+  check_format(1e-7, "1e-7");
+  check_format(1.5e-7, "1.5e-7");
+  check_format(123456789012345680000.0, "123456789012345680000");
+  check_format(5e-324, "5e-324");
+  check_format(1.7976931348623157e308, "1.7976931348623157e+308");
+  check_format(0.1f, "0.1");
+  check_format(-0.0, "-0");
+  check_format(std::numeric_limits<double>::infinity(), "inf");
+  check_format(-std::numeric_limits<float>::infinity(), "-inf");
+  check_format(std::nan(""), "nan");
+
+  std::mt19937_64 rng(17);
+  test_format_float_random<double, uint64_t>(rng, 200000);
+  test_format_float_random<float, uint32_t>(rng, 200000);
+}
+
+/*-----------------------------------------------------------------------------
+ *  Trie
+ *---------------------------------------------------------------------------*/
+
+// 小字母表使关键字之间大量共享前缀，偶尔使用全部 256 个字节。
+static std::string random_word(std::mt19937_64 &rng, size_t max_len,
+                               bool binary) {
+  std::string s(rng() % (max_len + 1), ' ');
+  for (auto &ch : s) {
+    ch = binary ? static_cast<char>(rng() % 256) : "abcAB"[rng() % 5];
+  }
+  return s;
+}
+
+static void test_trie_match() {
+  std::mt19937_64 rng(18);
+  for (auto iter = 0; iter < 2000; iter++) {
+    auto binary = iter % 4 == 0;
+    std::vector<std::string> words(rng() % 30);
+    for (auto &w : words) {
+      w = random_word(rng, 6, binary);
+    }
+    Trie trie(words);
+    for (auto k = 0; k < 20; k++) {
+      auto text = random_word(rng, 10, binary);
+      // 朴素实现：最长的是关键字的前缀，重复的关键字取第一个。
+      size_t len = 0;
+      size_t index = 0;
+      for (size_t l = 1; l <= text.size(); l++) {
+        auto it = std::find(words.begin(), words.end(), text.substr(0, l));
+        if (it != words.end()) {
+          len = l;
+          index = static_cast<size_t>(it - words.begin());
+        }
+      }
+      size_t got_index = ~size_t(0);
+      auto got = trie.match(text.data(), text.size(), got_index);
+      CHECK(got == len && (!len || got_index == index),
+            "match(\"%s\") is %zu, expected %zu", text.c_str(), got, len);
+    }
+  }
+}
+
+// scan 与在每个位置逐个比较所有关键字的结果相同。文本中夹杂不能开始
+// 关键字的字节，并且足够长，使 SIMD 预筛选的整块路径也被覆盖。
+static void test_trie_scan() {
+  using Match = std::tuple<size_t, size_t, size_t>;
+  std::mt19937_64 rng(19);
+  for (auto iter = 0; iter < 2000; iter++) {
+    auto binary = iter % 4 == 0;
+    std::vector<std::string> words(rng() % 12);
+    for (auto &w : words) {
+      w = random_word(rng, 4, binary);
+    }
+    std::string text;
+    auto len = rng() % 300;
+    while (text.size() < len) {
+      text += rng() % 3 ? std::string(rng() % 40, '.')
+                        : random_word(rng, 6, binary);
+    }
+
+    std::vector<Match> expected;
+    for (size_t end = 1; end <= text.size(); end++) {
+      for (auto l = end; l >= 1; l--) {
+        auto it = std::find(words.begin(), words.end(),
+                            text.substr(end - l, l));
+        if (it != words.end()) {
+          expected.emplace_back(end - l, l,
+                                static_cast<size_t>(it - words.begin()));
+        }
+      }
+    }
+    std::vector<Match> got;
+    Trie(words).scan(text.data(), text.size(),
+                     [&](size_t offset, size_t length, size_t index) {
+                       got.emplace_back(offset, length, index);
+                     });
+    CHECK(got == expected, "scan found %zu matches, expected %zu",
+          got.size(), expected.size());
+  }
+}
+
+using Matches = std::vector<std::tuple<size_t, size_t, size_t>>;
+
+static Matches scan_all(const Trie &trie, const std::string &text) {
+  Matches got;
+  trie.scan(text.data(), text.size(),
+            [&](size_t offset, size_t length, size_t index) {
+              got.emplace_back(offset, length, index);
+            });
+  return got;
+}
+
+// CaseFolding::Unicode 的朴素实现：像 Trie 一样把文本切成单元，需要折叠
+// 的合法字符是一个单元，其余每个字节是一个单元。记下每个单元在原文中的
+// 范围和折叠后的字节。
+struct FoldUnit {
+  size_t begin;
+  size_t end;
+  std::string folded;
+};
+
+static std::vector<FoldUnit> fold_units(const std::string &s) {
+  std::vector<FoldUnit> units;
+  for (size_t i = 0; i < s.size();) {
+    size_t bytes;
+    char32_t cp;
+    if (decode_codepoint_strict(s.data() + i, s.size() - i, bytes, cp) &&
+        fold_codepoint(cp) != cp) {
+      units.push_back({i, i + bytes, encode_codepoint(fold_codepoint(cp))});
+      i += bytes;
+    } else {
+      auto ch = s[i];
+      units.push_back({i, i + 1, std::string(1, 'A' <= ch && ch <= 'Z'
+                                                   ? ch + 32
+                                                   : ch)});
+      i++;
+    }
+  }
+  return units;
+}
+
+static void test_trie_unicode_folding() {
+  // CaseFolding.txt 中的 C 和 S 两类映射；只有 F 类（多个码点）的不折叠。
+  static_assert(fold_codepoint(U'A') == U'a' && fold_codepoint(U'a') == U'a');
+  static_assert(fold_codepoint(0x03A3) == 0x03C3 &&
+                fold_codepoint(0x03C2) == 0x03C3);
+  const std::pair<char32_t, char32_t> folds[] = {
+      {0x00B5, 0x03BC},   {0x00C0, 0x00E0},   {0x00DF, 0x00DF},
+      {0x00FF, 0x00FF},   {0x0100, 0x0101},   {0x0101, 0x0101},
+      {0x0130, 0x0130},   {0x0131, 0x0131},   {0x0149, 0x0149},
+      {0x0178, 0x00FF},   {0x017F, 0x0073},   {0x01C4, 0x01C6},
+      {0x01C5, 0x01C6},   {0x01C6, 0x01C6},   {0x0345, 0x03B9},
+      {0x03C3, 0x03C3},   {0x03F4, 0x03B8},   {0x0410, 0x0430},
+      {0x10A0, 0x2D00},   {0x13F8, 0x13F0},   {0x1C80, 0x0432},
+      {0x1E9B, 0x1E61},   {0x1E9E, 0x00DF},   {0x1E96, 0x1E96},
+      {0x1F88, 0x1F80},   {0x1FBE, 0x03B9},   {0x2126, 0x03C9},
+      {0x212A, 0x006B},   {0x212B, 0x00E5},   {0x24B6, 0x24D0},
+      {0x2C2F, 0x2C5F},   {0xA7C5, 0x0282},   {0xAB70, 0x13A0},
+      {0xFF21, 0xFF41},   {0x10400, 0x10428}, {0x1E921, 0x1E943},
+      {0x1E922, 0x1E922}, {0x10FFFF, 0x10FFFF},
+  };
+  for (auto [cp, folded] : folds) {
+    CHECK(fold_codepoint(cp) == folded, "fold_codepoint(U+%04X) is U+%04X",
+          static_cast<unsigned>(cp), static_cast<unsigned>(fold_codepoint(cp)));
+  }
+  // 折叠的结果不再折叠，区间表按码点递增。
+  for (char32_t cp = 0; cp <= 0x10FFFF; cp++) {
+    auto f = fold_codepoint(cp);
+    CHECK(fold_codepoint(f) == f, "U+%04X folds twice",
+          static_cast<unsigned>(cp));
+  }
+  for (size_t k = 1; k < std::size(detail::CaseFoldRanges); k++) {
+    CHECK(detail::CaseFoldRanges[k - 1].last < detail::CaseFoldRanges[k].first,
+          "CaseFoldRanges[%zu] is out of order", k);
+  }
+
+  // 报告的偏移和长度都是原文中的，折叠可能改变编码的长度。
+  //   Σ x ς \xFF K(U+212A) \xC3 ẞ STRAẞE ǅ \xE2\x84 K
+  std::vector<std::string> words = {"\xCF\x83", "k", "\xC3\x9F",
+                                    "\xC7\x86", "stra\xC3\x9F" "e"};
+  Trie trie(words, CaseFolding::Unicode);
+  std::string text = "\xCE\xA3" "x" "\xCF\x82" "\xFF" "\xE2\x84\xAA" "\xC3"
+                     "\xE1\xBA\x9E" "STRA\xE1\xBA\x9E" "E" "\xC7\x85"
+                     "\xE2\x84" "K";
+  Matches expected = {{0, 2, 0},  {3, 2, 0},  {6, 3, 1},  {10, 3, 2},
+                      {17, 3, 2}, {13, 8, 4}, {21, 2, 3}, {25, 1, 1}};
+  CHECK(scan_all(trie, text) == expected, "Unicode scan");
+  size_t index = 0;
+  CHECK(trie.match(text.data() + 13, text.size() - 13, index) == 8 &&
+            index == 4,
+        "match STRA\u1E9EE");
+  CHECK(trie.match(text.data() + 6, text.size() - 6, index) == 3 && index == 1,
+        "match U+212A");
+  CHECK(trie.match(text.data() + 21, 2, index) == 2 && index == 3,
+        "match U+01C5");
+  CHECK(trie.match(text.data() + 23, 3) == 0, "match a truncated sequence");
+
+  // 随机的关键字和文本由需要折叠的字符、大小写不同的写法和非法的字节
+  // 组成，结果与逐个单元比较的朴素实现相同。
+  const char *const pieces[] = {
+      "\xCF\x83", "\xCE\xA3", "\xCF\x82", "k",    "K", "\xE2\x84\xAA",
+      "\xC3\x9F", "\xE1\xBA\x9E", "\xC7\x84", "\xC7\x85", "\xC7\x86", "a",
+  };
+  const char *const junk[] = {"\xFF", "\xC3", "\xE2\x84", "\x80", " "};
+  std::mt19937_64 rng(20);
+  for (auto iter = 0; iter < 2000; iter++) {
+    std::vector<std::string> keys(1 + rng() % 8);
+    for (auto &w : keys) {
+      for (auto n = 1 + rng() % 3; n > 0; n--) {
+        w += pieces[rng() % std::size(pieces)];
+      }
+    }
+    std::string s;
+    for (auto n = rng() % 60; n > 0; n--) {
+      s += rng() % 4 ? pieces[rng() % std::size(pieces)]
+                     : junk[rng() % std::size(junk)];
+    }
+
+    std::vector<std::string> folded;
+    for (const auto &w : keys) {
+      std::string f;
+      for (const auto &u : fold_units(w)) {
+        f += u.folded;
+      }
+      folded.push_back(f);
+    }
+    auto find = [&](const std::string &f) {
+      return std::find(folded.begin(), folded.end(), f) - folded.begin();
+    };
+    auto units = fold_units(s);
+    Matches naive;
+    for (size_t b = 0; b < units.size(); b++) {
+      for (size_t a = 0; a <= b; a++) {
+        std::string f;
+        for (auto u = a; u <= b; u++) {
+          f += units[u].folded;
+        }
+        auto k = static_cast<size_t>(find(f));
+        if (k < keys.size()) {
+          naive.emplace_back(units[a].begin, units[b].end - units[a].begin, k);
+        }
+      }
+    }
+    Trie t(keys, CaseFolding::Unicode);
+    auto got_matches = scan_all(t, s);
+    CHECK(got_matches == naive, "Unicode scan found %zu matches, expected %zu",
+          got_matches.size(), naive.size());
+
+    size_t len = 0, k = 0;
+    std::string prefix;
+    for (const auto &u : units) {
+      prefix += u.folded;
+      auto f = static_cast<size_t>(find(prefix));
+      if (f < keys.size()) {
+        len = u.end;
+        k = f;
+      }
+    }
+    size_t got_index = ~size_t(0);
+    auto got = t.match(s.data(), s.size(), got_index);
+    CHECK(got == len && (!len || got_index == k),
+          "Unicode match is %zu, expected %zu", got, len);
+  }
+}
+
+// 足够多的关键字使排序分给 4 个线程，段数和段长都不整齐。重复的关键字
+// （包括折叠后相同的）必须取第一个的下标，与线程数无关。
+static void test_trie_parallel_build() {
+  std::mt19937_64 rng(24);
+  for (auto n : {10, 1000, 100000, 1 << 20}) {
+    std::vector<uint32_t> v(static_cast<size_t>(n));
+    for (auto &x : v) {
+      x = static_cast<uint32_t>(rng() % 5000);
+    }
+    auto expected = v;
+    std::sort(expected.begin(), expected.end());
+    for (auto threads : {0, 2, 3, 4, 7}) {
+      auto got = v;
+      detail::parallel_sort(got.begin(), got.end(), std::less<uint32_t>(),
+                            static_cast<size_t>(threads));
+      CHECK(got == expected, "parallel_sort of %d with %d threads", n,
+            threads);
+    }
+  }
+
+  std::vector<std::string> words(70001);
+  for (auto &w : words) {
+    w = random_word(rng, 8, false);
+  }
+  auto sorted = words;
+  std::sort(sorted.begin(), sorted.end());
+  for (auto folding : {CaseFolding::None, CaseFolding::Ascii}) {
+    std::unordered_map<std::string, size_t> first;
+    std::unordered_map<std::string, size_t> first_sorted;
+    auto fold = [&](std::string w) {
+      if (folding == CaseFolding::Ascii) {
+        for (auto &ch : w) {
+          ch = static_cast<char>(std::tolower(static_cast<uint8_t>(ch)));
+        }
+      }
+      return w;
+    };
+    for (size_t k = 0; k < words.size(); k++) {
+      first.emplace(fold(words[k]), k);
+      first_sorted.emplace(fold(sorted[k]), k);
+    }
+
+    Trie single(words, folding, 1);
+    Trie parallel(words, folding, 4);
+    // 已经有序时跳过排序。
+    Trie presorted(sorted, folding, 4);
+    for (size_t k = 0; k < words.size(); k += 7) {
+      const auto &w = words[k];
+      if (w.empty()) { continue; }  // 空关键字永远不会被匹配
+      auto expected = first[fold(w)];
+      size_t i1 = ~size_t(0), i4 = ~size_t(0), is = ~size_t(0);
+      auto l1 = single.match(w.data(), w.size(), i1);
+      auto l4 = parallel.match(w.data(), w.size(), i4);
+      CHECK(l1 == w.size() && l4 == w.size() && i1 == expected &&
+                i4 == expected,
+            "\"%s\": index %zu and %zu, expected %zu", w.c_str(), i1, i4,
+            expected);
+      presorted.match(w.data(), w.size(), is);
+      CHECK(is == first_sorted[fold(w)], "\"%s\" in sorted keywords",
+            w.c_str());
+    }
+    auto text = random_word(rng, 2000, false);
+    CHECK(scan_all(single, text) == scan_all(parallel, text),
+          "scan with 1 and 4 threads");
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  StaticTrie
+ *---------------------------------------------------------------------------*/
+
+// 重复的关键字取第一个的下标，空关键字永远不会被匹配。
+static constexpr std::array<std::string_view, 8> StaticWords{
+    "if", "in", "int", "", "in", "integer", "else", "i\xFF"};
+using StaticKeywords = StaticTrie<StaticWords>;
+
+constexpr size_t static_index(const char *s, size_t n) {
+  size_t index = ~size_t(0);
+  StaticKeywords::match(s, n, index);
+  return index;
+}
+
+static_assert(StaticKeywords::match("integers", 8) == 7);
+static_assert(StaticKeywords::match("int x", 5) == 3);
+static_assert(StaticKeywords::match("inx", 3) == 2);
+static_assert(StaticKeywords::match("i", 1) == 0);
+static_assert(StaticKeywords::match("x", 1) == 0);
+static_assert(StaticKeywords::match("", 0) == 0);
+static_assert(StaticKeywords::match("i\xFF", 2) == 2);
+static_assert(StaticKeywords::match("integer", 6) == 3);
+static_assert(static_index("in", 2) == 1);
+static_assert(static_index("integer", 7) == 5);
+static_assert(static_index("x", 1) == ~size_t(0));
+// 关键字中有 10 个不同的字节，其余的字节共用一类。
+static_assert(StaticKeywords::ClassCount == 11);
+
+static constexpr const char *StaticPrefixWords[] = {
+    "a", "ab", "abc", "b", "ba", "bab", "c", "ca", "cab", "abcab", "ab", "cc",
+};
+using StaticPrefixes = StaticTrie<StaticPrefixWords>;
+static_assert(StaticPrefixes::match("abcabc", 6) == 5);
+
+// 在随机文本的每个位置与 Trie 比较。
+static void test_static_trie() {
+  Trie trie(std::vector<std::string>(std::begin(StaticPrefixWords),
+                                     std::end(StaticPrefixWords)));
+  std::mt19937_64 rng(22);
+  for (auto iter = 0; iter < 200; iter++) {
+    std::string text(rng() % 100, ' ');
+    for (auto &ch : text) {
+      ch = "abcd"[rng() % 4];
+    }
+    for (size_t i = 0; i <= text.size(); i++) {
+      size_t expected_index = ~size_t(0), index = ~size_t(0);
+      auto expected =
+          trie.match(text.data() + i, text.size() - i, expected_index);
+      auto len = StaticPrefixes::match(text.data() + i, text.size() - i, index);
+      CHECK(len == expected && index == expected_index,
+            "StaticTrie::match(\"%s\") is %zu, expected %zu", text.c_str() + i,
+            len, expected);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ *  Trie image
+ *---------------------------------------------------------------------------*/
+
+// 映像按 uint64_t 分配以满足 view 的对齐要求。
+static std::vector<uint64_t> save_image(const Trie &trie, size_t &size) {
+  std::ostringstream out;
+  trie.save(out);
+  auto bytes = out.str();
+  size = bytes.size();
+  std::vector<uint64_t> image((size + 7) / 8);
+  std::memcpy(image.data(), bytes.data(), size);
+  return image;
+}
+
+template <typename F> static bool throws(F f) {
+  try {
+    f();
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+static void test_trie_image() {
+  std::mt19937_64 rng(23);
+  auto random_text = [&](bool binary) {
+    std::string text;
+    while (text.size() < 200) {
+      text += rng() % 4 ? random_word(rng, 6, binary) : "\xC3\x84\xCE\xA3";
+    }
+    return text;
+  };
+
+  // save 之后 view、verified_view 和 load 得到的 Trie 与原来的匹配结果相同。
+  for (auto iter = 0; iter < 300; iter++) {
+    auto binary = iter % 4 == 0;
+    auto folding = static_cast<CaseFolding>(iter % 3);
+    std::vector<std::string> words(1 + rng() % 20);
+    for (auto &w : words) {
+      w = random_word(rng, 5, binary);
+    }
+    words.push_back("\xC3\xA4\xCF\x83");
+    Trie trie(words, folding);
+    size_t size;
+    auto image = save_image(trie, size);
+    auto viewed = Trie::view(image.data(), size);
+    auto verified = Trie::verified_view(image.data(), size);
+    CHECK(viewed.folding() == folding, "folding is not saved");
+    for (auto k = 0; k < 10; k++) {
+      auto text = random_text(binary);
+      auto expected = scan_all(trie, text);
+      CHECK(scan_all(viewed, text) == expected, "view: scan differs");
+      CHECK(scan_all(verified, text) == expected,
+            "verified_view: scan differs");
+      size_t index = 0, viewed_index = 0;
+      auto len = trie.match(text.data(), text.size(), index);
+      CHECK(viewed.match(text.data(), text.size(), viewed_index) == len &&
+                index == viewed_index,
+            "view: match differs");
+    }
+  }
+
+  std::vector<std::string> words = {"he", "she", "his", "hers", "\xC3\xA4"};
+  Trie trie(words, CaseFolding::Unicode);
+  auto path = "test-trie.img";
+  trie.save(path);
+  auto loaded = Trie::load(path);
+  std::remove(path);
+  auto text = std::string("USHERS \xC3\x84 his");
+  CHECK(scan_all(loaded, text) == scan_all(trie, text), "load: scan differs");
+  CHECK(throws([&] { Trie::load(path); }), "load of a missing file");
+  CHECK(throws([&] {
+          std::ostringstream out;
+          Trie().save(out);
+        }),
+        "save of an empty trie");
+
+  // 文件头不符、未对齐或大小不对的映像被 view 拒绝。
+  size_t size;
+  auto image = save_image(trie, size);
+  auto data = reinterpret_cast<char *>(image.data());
+  auto rejected = [&](std::vector<uint64_t> bad, size_t bad_size,
+                      size_t shift = 0) {
+    auto p = reinterpret_cast<char *>(bad.data());
+    return throws([&] { Trie::view(p + shift, bad_size); }) &&
+           throws([&] { Trie::verified_view(p + shift, bad_size); });
+  };
+  CHECK(rejected(image, size - 1), "truncated image");
+  CHECK(rejected(image, size - 24), "image without the last unit");
+  CHECK(rejected(image, 100), "image shorter than the header");
+  CHECK(rejected(image, 0), "empty image");
+  std::vector<uint64_t> longer(image);
+  longer.push_back(0);
+  CHECK(rejected(longer, size + 8), "image with trailing bytes");
+  // 整体后移 4 个字节后内容不变，但不再按 8 字节对齐。
+  std::vector<uint64_t> shifted(image.size() + 1);
+  std::memcpy(reinterpret_cast<char *>(shifted.data()) + 4, data, size);
+  CHECK(rejected(shifted, size, 4), "misaligned image");
+  // 依次改动 magic、version、byte_order、unit_count 和 folding。
+  for (auto offset : {0, 7, 8, 12, 16, 23, 32}) {
+    auto bad = image;
+    reinterpret_cast<char *>(bad.data())[offset] ^= 0x40;
+    CHECK(rejected(bad, size), "header byte %d changed", offset);
+  }
+  // max_depth 不对时只有 verified_view 能发现。
+  auto bad_depth = image;
+  bad_depth[3]++;
+  CHECK(throws([&] { Trie::verified_view(bad_depth.data(), size); }),
+        "wrong max_depth");
+
+  // 随机改写映像中的字节：verified_view 要么拒绝，要么得到的 Trie 可以
+  // 安全地匹配和扫描（越界访问由 make sanitize 发现）。
+  auto header_size = size - 24 * static_cast<size_t>(image[2]);
+  auto accepted = 0;
+  for (auto iter = 0; iter < 3000; iter++) {
+    auto bad = image;
+    auto p = reinterpret_cast<uint8_t *>(bad.data());
+    for (auto k = 1 + rng() % 3; k > 0; k--) {
+      // 多数改动落在状态上，偶尔落在文件头。
+      auto offset = rng() % 8 ? header_size + rng() % (size - header_size)
+                              : rng() % header_size;
+      if (rng() % 2) {
+        p[offset] ^= static_cast<uint8_t>(1 << rng() % 8);
+      } else {
+        p[offset] = static_cast<uint8_t>(rng());
+      }
+    }
+    Trie t;
+    try {
+      t = Trie::verified_view(bad.data(), size);
+    } catch (const std::runtime_error &) {
+      continue;
+    }
+    accepted++;
+    for (auto k = 0; k < 3; k++) {
+      auto text = random_text(k == 0);
+      scan_all(t, text);
+      t.match(text.data(), text.size());
+    }
+  }
+  CHECK(accepted > 0 && accepted < 3000, "%d corrupt images accepted",
+        accepted);
+}
+
+/*-----------------------------------------------------------------------------
+ *  SharedTrie
+ *---------------------------------------------------------------------------*/
+
+static std::vector<std::string> generation(int g) {
+  std::vector<std::string> words;
+  for (auto k = 0; k < 50; k++) {
+    words.push_back("g" + std::to_string(g) + "_" + std::to_string(k));
+  }
+  return words;
+}
+
+static void test_shared_trie() {
+  SharedTrie shared({"alpha", "beta"});
+  {
+    auto snapshot = shared.snapshot();
+    CHECK(snapshot->match("alphabet", 8) == 5, "initial version");
+    CHECK(snapshot.keywords().size() == 2, "initial version");
+  }
+  shared.update({"gamma", "alpha"}, {"beta"});
+  {
+    auto snapshot = shared.snapshot();
+    size_t index = 0;
+    CHECK(snapshot->match("gamma", 5, index) == 5 &&
+              snapshot.keywords()[index] == "gamma",
+          "inserted keyword");
+    CHECK(snapshot->match("beta", 4) == 0, "erased keyword");
+  }
+
+  // 读者不断取得快照，写者每次把整代关键字换成下一代。每个快照都必须是
+  // 某一代完整的关键字，并且它的 Trie 能匹配其中的每个关键字；旧版本被
+  // 提前释放时这里会读到已释放的内存。
+  shared.update(generation(0), {"alpha", "gamma"});
+  std::atomic<bool> stop{false};
+  std::atomic<int> errors{0};
+  std::vector<std::thread> readers;
+  for (auto t = 0; t < 4; t++) {
+    readers.emplace_back([&, t]() {
+      std::mt19937_64 rng(static_cast<uint64_t>(t));
+      while (!stop) {
+        auto snapshot = shared.snapshot();
+        const auto &words = snapshot.keywords();
+        auto prefix = words.front().substr(0, words.front().find('_'));
+        for (const auto &w : words) {
+          if (w.compare(0, prefix.size() + 1, prefix + "_")) { errors++; }
+        }
+        const auto &w = words[rng() % words.size()];
+        size_t index = ~size_t(0);
+        if (words.size() != 50 ||
+            snapshot->match(w.data(), w.size(), index) != w.size() ||
+            words[index] != w) {
+          errors++;
+        }
+      }
+    });
+  }
+  for (auto g = 1; g <= 50; g++) {
+    shared.update(generation(g), generation(g - 1));
+  }
+  stop = true;
+  for (auto &r : readers) {
+    r.join();
+  }
+  CHECK(!errors, "%d inconsistent snapshots", errors.load());
+  CHECK(shared.snapshot().keywords() == [] {
+    auto words = generation(50);
+    std::sort(words.begin(), words.end());
+    return words;
+  }(), "last generation");
+}
+
+int main() {
+  test_codepoint_count();
+  test_encode();
+  test_validate_utf8();
+  test_line_index();
+  test_character_set();
+  test_resolve_escape_sequence();
+  test_parse_float();
+  test_parse_number();
+  test_parse_numbers();
+  test_format_float();
+  test_trie_match();
+  test_trie_scan();
+  test_trie_parallel_build();
+  test_static_trie();
+  test_trie_unicode_folding();
+  test_trie_image();
+  test_shared_trie();
+  if (failures) {
+    std::printf("%d failure(s)\n", failures);
+    return 1;
+  }
+  std::printf("all tests passed\n");
+  return 0;
+}